@@ -1,10 +1,20 @@
 #ifndef _CONFPARSE_H_
 #define _CONFPARSE_H_
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <memory.h>
 
 #define CFG_HEAP_SIZE 1024
+#define CFG_HEAP_SIZE_MAX (1024 * 1024) // Growth heaps double in size up to this.
 #define CFG_SEARCH_DEPTH_MAX (uint)-1
+#define CFG_XPATH_PREDICATES_MAX 8
+#define CFG_BATCH_NAMES_MAX 256
+#define CFG_SINK_BUFFER_SIZE (64 * 1024)
+#define CFG_PRINT_THREADS_MAX 64
+#define CFG_PRINT_SPLIT_MIN (256 * 1024) // Parallel printing gives each thread at least this much estimated output.
+#define CFG_LIVE_READERS_MAX 256
+#define CFG_LIVE_NO_READER (~0u)
 
 namespace cfg
 {
@@ -14,6 +24,16 @@ namespace cfg
 	    return (c - str);
     }
 
+    // 32-bit FNV-1a.
+    constexpr unsigned int HashString(const char *str, size_t len) {
+        unsigned int h = 2166136261u;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)str[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
     inline bool StringCompare(char *str1, char *str2) {
 	    auto c1 = str1;
     	auto c2 = str2;
@@ -23,7 +43,23 @@ namespace cfg
     		++c1;
 	    	++c2;
     	}
-    	return true;
+    	return *c1 == *c2; // Both strings must end together, "ab" doesn't match "abc".
+    }
+
+    // A name whose length and hash are known up front. Key literals ("lifespan"_key) are hashed by the compiler,
+    // so lookups through them skip hashing the query entirely.
+    struct Key {
+        const char *name;
+        unsigned int len;
+        unsigned int hash;
+    };
+
+    inline namespace literals {
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L) || __cplusplus >= 202002L
+        consteval Key operator""_key(const char *str, size_t len) { return Key{ str, (unsigned int)len, HashString(str, len) }; }
+#else
+        constexpr Key operator""_key(const char *str, size_t len) { return Key{ str, (unsigned int)len, HashString(str, len) }; }
+#endif
     }
 
 	typedef void *(*malloc_t)(size_t);
@@ -49,12 +85,40 @@ namespace cfg
         }
     }
     
+    enum eNodeFlag {
+        eNodeFlag_PackedChildren = 1 << 0, // Children are contiguous in memory and child_count is valid (see Container::Finalize).
+        eNodeFlag_Array          = 1 << 1, // A JSON array, children are unnamed. Lets empty arrays print as '[]'.
+        eNodeFlag_Bare           = 1 << 2, // A JSON number or literal (true/false/null), printed without quotes.
+        eNodeFlag_JsonEscaped    = 1 << 3, // 'str' still holds raw JSON escapes, decoded by GetString().
+        eNodeFlag_XmlEscaped     = 1 << 4, // 'str' still holds raw XML entities, decoded by GetString().
+        eNodeFlag_NeedsEscape    = 1 << 5, // 'str' has characters that must be escaped when printed.
+        eNodeFlag_NameEscape     = 1 << 6, // Same as above, for 'name'.
+        eNodeFlag_Dirty          = 1 << 7, // The node, or something below it, changed since it was parsed.
+        eNodeFlag_Restructured   = 1 << 8, // Its children or attributes were added, removed or reordered.
+    };
+
+    enum eValueType {
+        eValueType_Unknown,  // Not classified yet (see Container::Classify).
+        eValueType_None,     // No scalar, eg: a section, object or array.
+        eValueType_String,
+        eValueType_Integer,  // Fits in int64_t.
+        eValueType_Unsigned, // Only fits in uint64_t.
+        eValueType_Float,
+        eValueType_Bool,
+        eValueType_Null,
+        eValueType_Int32Array,  // Typed arrays attached by Node::AttachNumberArray.
+        eValueType_FloatArray,
+        eValueType_DoubleArray,
+    };
+
     enum eFileType {
         eFileType_Unknown,
         eFileType_Ini,
         eFileType_Xml,
         eFileType_Json,
         eFileType_Yaml,
+        eFileType_Cbor,    // Binary, parsed into the same tree as JSON.
+        eFileType_MsgPack, // Same.
     };
 
     struct Node
@@ -64,13 +128,321 @@ namespace cfg
         Node *first_attribute; // Primarily for XML
         Node *first_child;
         Node *next;
+        Node *parent;           // The owning node, nullptr at the top level.
+        Node *last_child;       // Tail for appends. Only a hint, nullptr or stale means the list is walked once.
+        unsigned int name_len;  // Recorded by the parsers, along with name_hash (see HashString).
+        unsigned int name_hash;
+        unsigned int flags;     // eNodeFlag
+        unsigned int child_count;
+        unsigned int src_begin; // Where the node was in Container::source, both 0 if it wasn't parsed from there.
+        unsigned int src_end;
+
+        // The decoded scalar, once classified. Typed accessors read this instead of re-parsing 'str'.
+        union Scalar {
+            int64_t  i;
+            uint64_t u;
+            double   f;
+            bool     b;
+            struct {
+                void  *data;
+                size_t count;
+            } array;
+        };
+        eValueType value_type;
+        Scalar     value;
+
+        // Cheap length/hash rejection before any bytes are compared.
+        inline bool NameEquals( const char *str, unsigned int len, unsigned int hash ) {
+            return name_hash == hash && name_len == len && name && memcmp(name, str, len) == 0;
+        }
 
         Node *GetChild( char *name, unsigned int depth );
-        Node *GetChild( unsigned int idx );
+        Node *GetChild( unsigned int idx ); // O(1) once the container has been finalized.
+        unsigned int ChildCount();
         Node *GetAttribute( char *name ); // Primarily for XML
         Node *GetSibling( char *name );
-        inline int AsInteger() { if (str) return atoi(str); return 0; }
-        inline float AsFloat() { if (str) return (float)atof(str); return 0; }
+        Node *GetChild( Key key, unsigned int depth );
+        Node *GetAttribute( Key key );
+        Node *GetSibling( Key key );
+
+        // Batch lookups: fill out[i] with the node named names[i] (or nullptr) in a single pass over the list.
+        // Returns the number of names found. GetAttributes is the INI section equivalent (keys are attributes).
+        unsigned int GetChildren( char **names, Node **out, unsigned int count );
+        unsigned int GetAttributes( char **names, Node **out, unsigned int count );
+        // 'str' with JSON escapes / XML entities decoded. Strings without any are returned as-is; the rest are
+        // decoded in place the first time they're asked for. Container::DecodeStrings does the whole tree up front.
+        char *GetString();
+
+        // Classifies 'str' and caches the decoded value. Type() doesn't cache, so it's safe on shared trees.
+        void       Classify();
+        eValueType Type();
+
+        // Like atoi/atof, the As* functions return 0 if 'str' isn't a number (or it doesn't fit); floats are truncated
+        // for the integer accessors. TryAs only succeeds if the whole string is a number that fits in T.
+        // Supported T: int, unsigned int, int64_t, uint64_t, float, double.
+        int      AsInteger();
+        float    AsFloat();
+        int64_t  AsInt64();
+        uint64_t AsUInt64();
+        double   AsDouble();
+        template <typename T> bool TryAs( T &out );
+
+        // Bulk extraction into a caller buffer, from the node's attached typed array, its children (eg: a JSON array)
+        // or a delimited list in its own 'str' (eg: "0.5 1.0, 2.0"). Returns the number of values written, stopping at
+        // 'max' or at the first element that isn't a number of the requested type.
+        size_t ExtractFloats( float *out, size_t max );
+        size_t ExtractDoubles( double *out, size_t max );
+        size_t ExtractInt32( int32_t *out, size_t max );
+
+        // Parses the node's numbers once into a typed array in the container's arena (value_type becomes one of the
+        // *Array types), after which the Extract functions are a copy. 'type' is Int32Array, FloatArray or DoubleArray.
+        bool AttachNumberArray( struct Container *ctn, eValueType type );
+
+        // Editing. New nodes, names and strings are copied into the container's growth heap, and every edit marks what
+        // it touched dirty (see Container::MarkDirty). 'name' is nullptr for array elements, 'str' nullptr for none
+        // (printed as an empty INI value or XML attribute). Strings set here are plain strings, escaped when printed.
+        // Appends are O(1). INI keys are added with SetAttribute, AppendChild returns nullptr on an INI tree.
+        Node *AppendChild( struct Container *ctn, const char *name, const char *str = nullptr );
+        Node *InsertAfter( struct Container *ctn, const char *name, const char *str = nullptr ); // A new sibling.
+        bool  SetName( struct Container *ctn, const char *name );
+        bool  SetString( struct Container *ctn, const char *str );
+        Node *SetAttribute( struct Container *ctn, const char *name, const char *str ); // Adds it if it isn't there.
+        bool  Remove( struct Container *ctn ); // Unlinks the node (and everything below it) from its parent.
+    };
+
+    template <> bool Node::TryAs<int>( int &out );
+    template <> bool Node::TryAs<unsigned int>( unsigned int &out );
+    template <> bool Node::TryAs<int64_t>( int64_t &out );
+    template <> bool Node::TryAs<uint64_t>( uint64_t &out );
+    template <> bool Node::TryAs<float>( float &out );
+    template <> bool Node::TryAs<double>( double &out );
+
+    /// ---- Struct binding ---- ///
+    // Deserializes a node straight into a C++ struct. Describe the struct once, at global scope:
+    //
+    //   struct Human { int lifespan; float height; double favorite_number; const char *name; };
+    //   CFG_BIND(Human, lifespan, height, favorite_number, name)
+    //
+    //   Human h = {};
+    //   cfg::Bind(ctn->GetNode("human_data"_key, 0), h);
+    //
+    // Field names are hashed at compile time into a small open-addressed table, so binding is one pass over
+    // the node's attributes and children with one table probe per key. Fields may be integers, floats, bool,
+    // const char * (points into the tree) or another bound struct. Keys without a field are ignored and
+    // fields without a key keep their value. A repeated key binds from its first occurrence. Up to 64 fields per struct.
+    struct Field {
+        Key key;
+        size_t offset;
+        bool (*read)( Node *n, void *dst );
+    };
+
+    template <unsigned int N>
+    struct FieldTable {
+        static constexpr unsigned int Bits() {
+            unsigned int bits = 1;
+            while ((1u << bits) < (N * 2))
+                ++bits;
+            return bits;
+        }
+
+        Field fields[N];
+        unsigned char slots[1u << Bits()]; // Field index + 1, 0 for empty.
+
+        constexpr FieldTable( const Field (&f)[N] ) : fields(), slots() {
+            for (unsigned int i = 0; i < N; ++i) {
+                fields[i] = f[i];
+                unsigned int slot = (f[i].key.hash * 2654435761u) >> (32 - Bits());
+                while (slots[slot])
+                    slot = (slot + 1) & ((1u << Bits()) - 1);
+                slots[slot] = (unsigned char)(i + 1);
+            }
+        }
+
+        const Field *Find( Node *n ) const {
+            unsigned int slot = (n->name_hash * 2654435761u) >> (32 - Bits());
+            while (slots[slot]) {
+                auto f = &fields[slots[slot] - 1];
+                if (n->NameEquals(f->key.name, f->key.len, f->key.hash))
+                    return f;
+                slot = (slot + 1) & ((1u << Bits()) - 1);
+            }
+            return nullptr;
+        }
+    };
+
+    // Specialized by CFG_BIND.
+    template <typename T> struct Binding;
+
+    template <typename T>
+    bool Bind( Node *n, T &out ) {
+        if (!n)
+            return false;
+
+        constexpr auto &table = Binding<T>::table;
+        constexpr unsigned int count = sizeof(table.fields) / sizeof(Field);
+        constexpr uint64_t all = (count == 64) ? ~0ull : ((1ull << count) - 1);
+        uint64_t seen = 0;
+        bool ok = true;
+
+        // INI keys and XML attributes live in first_attribute, JSON/XML children in first_child.
+        for (int list = 0; list < 2 && seen != all; ++list) {
+            for (auto c = list ? n->first_child : n->first_attribute; c && seen != all; c = c->next) {
+                auto f = table.Find(c);
+                if (!f)
+                    continue;
+                uint64_t bit = 1ull << (f - table.fields);
+                if (seen & bit)
+                    continue;
+                seen |= bit;
+                ok &= f->read(c, (char *)&out + f->offset);
+            }
+        }
+        return ok;
+    }
+
+    template <typename T> struct FieldReader {
+        static bool Read( Node *n, void *dst ) { return Bind(n, *(T *)dst); }
+    };
+    template <> struct FieldReader<bool> {
+        static bool Read( Node *n, void *dst ) {
+            if (n->Type() == eValueType_Bool) {
+                *(bool *)dst = (n->str[0] == 't');
+                return true;
+            }
+            int64_t i;
+            if (!n->TryAs(i))
+                return false;
+            *(bool *)dst = (i != 0);
+            return true;
+        }
+    };
+    template <> struct FieldReader<const char *> {
+        static bool Read( Node *n, void *dst ) { *(const char **)dst = n->GetString(); return n->str != nullptr; }
+    };
+    template <> struct FieldReader<char *> {
+        static bool Read( Node *n, void *dst ) { *(char **)dst = n->GetString(); return n->str != nullptr; }
+    };
+#define CFG_FIELD_READER_NUMBER(type) \
+    template <> struct FieldReader<type> { \
+        static bool Read( Node *n, void *dst ) { return n->TryAs(*(type *)dst); } \
+    };
+    CFG_FIELD_READER_NUMBER(int)
+    CFG_FIELD_READER_NUMBER(unsigned int)
+    CFG_FIELD_READER_NUMBER(int64_t)
+    CFG_FIELD_READER_NUMBER(uint64_t)
+    CFG_FIELD_READER_NUMBER(float)
+    CFG_FIELD_READER_NUMBER(double)
+#undef CFG_FIELD_READER_NUMBER
+
+    // A lookup path compiled once from either a dotted string ("glossary.GlossDiv.title")
+    // or a JSON Pointer ("/glossary/GlossDiv/title"). Numeric segments index unnamed (array) children.
+    // The node found by Container::Resolve is cached, so repeated queries against an unchanged
+    // container only cost a pointer and generation check. Filling the cache writes to the Path, so a Path
+    // used that way belongs to one thread. Version::Resolve, and Container::Resolve on a versioned or
+    // live container, never touch the cache, so one Path can be shared by all their readers.
+    struct Path
+    {
+        struct Segment {
+            char *name;
+            unsigned int len;
+            unsigned int hash;
+            int index; // -1 if the segment isn't a number.
+        };
+
+        Segment     *segments;
+        unsigned int count;
+
+        // Resolve cache.
+        const void  *cached_owner;
+        unsigned int cached_generation;
+        Node        *cached_node;
+
+        bool Compile( const char *path );
+        void Release();
+    };
+
+    // A compiled subset of XPath 1.0 for querying XML containers, eg:
+    //   /catalog/book[@id='bk101']/price
+    //   //book[genre='Fantasy']
+    //   /catalog/book[2]/@id
+    // Supported: child ('/') and descendant ('//') axes, name tests and '*', a trailing attribute step ('@name'),
+    // and predicates of the form [N], [last()], [@attr], [@attr='value'], [child] and [child='value'].
+    struct XPath
+    {
+        enum ePredicate {
+            ePredicate_Position,
+            ePredicate_Last,
+            ePredicate_HasAttribute,
+            ePredicate_AttributeEquals,
+            ePredicate_HasChild,
+            ePredicate_ChildEquals,
+        };
+
+        struct Predicate {
+            ePredicate kind;
+            char *name;
+            unsigned int len;
+            unsigned int hash;
+            char *value;
+            unsigned int value_len;
+            unsigned int position;
+        };
+
+        struct Step {
+            bool descendant;
+            bool attribute;
+            bool wildcard;
+            char *name;
+            unsigned int len;
+            unsigned int hash;
+            Predicate *predicates;
+            unsigned int predicate_count;
+        };
+
+        Step        *steps;
+        unsigned int count;
+
+        bool Compile( const char *expr );
+        void Release();
+    };
+
+    // Where Container::Write sends its output. Output is buffered in CFG_SINK_BUFFER_SIZE pieces and handed to
+    // 'write' as one or more chunks each time the buffer fills (large strings are passed through without a copy).
+    struct Sink {
+        struct Chunk {
+            const char *data;
+            size_t len;
+        };
+
+        // Return false to stop writing.
+        bool (*write)( void *user, const Chunk *chunks, unsigned int count );
+        void *user;
+
+        static Sink Callback( bool (*write)( void *, const Chunk *, unsigned int ), void *user ) { return Sink{ write, user }; }
+        static Sink File( int fd ); // write/writev to a file descriptor.
+    };
+
+    struct PrintOptions {
+        bool compact = false;          // No indentation or line breaks, minimal separators.
+        char indent = '\t';            // Pretty printing indents with 'indent_width' of these per level.
+        unsigned int indent_width = 1;
+        unsigned int threads = 1;      // Above 1, big trees are printed by that many threads. 0 uses every core. Not with a Sink.
+        bool incremental = false;      // Copy unchanged nodes straight from Container::source (see MarkDirty). Not with 'compact'.
+    };
+
+    // One published version of a versioned container (see Container::EnableVersions). Its nodes never change, so any
+    // number of threads can read it while new versions are published. 'parent' isn't meaningful in versioned trees:
+    // subtrees are shared between versions and point at the parent they were first parsed or copied under.
+    struct Version
+    {
+        Node        *first;
+        unsigned int number;     // 1 for the tree EnableVersions started from, then one more per edit.
+        unsigned int generation; // For Path caches.
+        Version     *previous;
+
+        Node *GetNode( char *name, unsigned int depth );
+        Node *GetNode( Key key, unsigned int depth );
+        Node *Resolve( Path &path );
     };
 
     struct Container
@@ -79,16 +451,192 @@ namespace cfg
         Heap  base_heap;
         Heap *heap;
         Node *first;
+        Node *last;              // Tail hint for AppendChild, like Node::last_child.
+        unsigned int generation; // Changes whenever the tree does. Used to invalidate Path caches.
+        unsigned int top_flags;  // eNodeFlag_Dirty / eNodeFlag_Restructured for the top level list.
+
+        // The buffer given to Parse. Only used by incremental printing, which needs it kept alive and unchanged.
+        const char *source;
+        size_t      source_len;
+
+        // The image behind a tree loaded with LoadSnapshot, released with the container.
+        void       *snapshot;
+        size_t      snapshot_size;
+        char       *file_buffer; // A copy of the source the container owns (ParseFile, LiveConfig), freed by Release.
+        struct VersionState *versions; // Set by EnableVersions.
+        bool        shared;      // Read by several threads at once (published by LiveConfig), Resolve doesn't cache.
 
         bool   Parse( char *source, size_t len, eFileType type );
+
+        // Reads and parses a file. With a cache directory, the file's contents are hashed and a snapshot of the parsed tree
+        // is kept there under that hash, so an unchanged file is loaded from its snapshot instead of being parsed again.
+        // The container must be zero initialised (or released) first, a buffer from an earlier ParseFile is freed.
+        bool   ParseFile( const char *path, eFileType type, const char *cache_dir = nullptr );
         void   Release();
+        void  *Allocate( size_t size ); // Zeroed memory from the growth heap chain, freed by Release.
+        Node  *AppendChild( const char *name, const char *str = nullptr ); // A new top level node, see Node::AppendChild.
+
+        // Copy-on-write mode. Once enabled the tree isn't edited in place any more: the Path based edits below each
+        // publish a new Version that copies the sibling lists from the top level down to the change and shares the rest.
+        // Readers on any thread call Current() and read that version without locks for as long as they like. Edits must
+        // come from one thread at a time (the same one that owns the container), and don't mix them with the Node
+        // editing functions. Every version stays valid until Release. Returns nullptr if the path doesn't resolve.
+        bool     EnableVersions();
+        Version *Current();
+        Version *SetString( Path &path, const char *str );
+        Version *AppendChild( Path &parent, const char *name, const char *str = nullptr ); // An empty path is the top level.
+        Version *Remove( Path &path );
         Node  *GetNode( char *name, unsigned int depth );
+        Node  *GetNode( Key key, unsigned int depth );
+        Node  *Resolve( Path &path );
+
+        // Classifies every scalar in the tree so typed accessors become a single load.
+        void   Classify();
+
+        // Decodes every escaped string now rather than on first access. Do this before sharing a tree between threads.
+        void   DecodeStrings();
+
+        // Records that 'node' changed, so incremental printing re-emits it (and the nodes above it) instead of
+        // copying its source. Pass 'restructured' when the node's children or attributes were added, removed or
+        // reordered; nullptr with 'restructured' means the top level list.
+        void   MarkDirty( Node *node, bool restructured = false );
+
+        // Re-lays the tree out so every node's children (and attributes) sit in one contiguous array,
+        // which makes GetChild(idx) and ChildCount() O(1). Nodes move, so pointers taken before this are stale.
+        bool   Finalize();
+
+        // Writes up to 'max' matches to 'out' in document order, each node once, and returns how many were found.
+        // Evaluation stops as soon as 'max' nodes have been matched.
+        size_t Select( XPath &xpath, Node **out, size_t max );
+        Node  *SelectFirst( XPath &xpath );
 
         // 'Print' outputs a correctly formatted document in the format specified by file_type.
-        // Note: The file_type *MUST* match the file_type of the input document. This is subject to change.
-        size_t Print( char **dst );
+        // '*dst' is NUL terminated and freed with cbk::free. Returns the length, not counting the terminator.
+        size_t Print( char **dst, const PrintOptions &options = PrintOptions() );
+
+        // Prints the tree as 'target' (Ini, Xml or Json) directly, whatever it was parsed from. See rules.txt for the mapping.
+        // Trees parsed from JSON, CBOR or MessagePack can also be printed as CBOR or MessagePack; use the returned length for those.
+        size_t Print( char **dst, eFileType target, const PrintOptions &options = PrintOptions() );
+
+        // Same output as Print, streamed to 'sink' through a fixed size buffer instead of built in memory.
+        bool   Write( Sink &sink, const PrintOptions &options = PrintOptions() );
+        bool   Write( Sink &sink, eFileType target, const PrintOptions &options = PrintOptions() );
+
+        // Saves the tree as a binary image that LoadSnapshot maps straight back in, with no parsing. Saving decodes
+        // and classifies the tree first, so nothing in a loaded snapshot ever needs rewriting.
+        bool   SaveSnapshot( const char *path );
+        bool   LoadSnapshot( const char *path );
+    };
+
+    // Hot reloading for configs read by many threads. A reload parses a whole new container away from the readers
+    // and swaps it in atomically, so a reader sees either the old tree or the new one, never a partial one. Readers
+    // never lock: each one registers once for a slot, then brackets every use with Acquire/Drop. Replaced containers
+    // are released once no reader holds them, on the next reload or Reclaim.
+    //
+    //   unsigned int me = live.Register();        // Once per reader thread.
+    //   if (auto ctn = live.Acquire(me)) { ... }  // Valid until Drop, whatever reloads happen meanwhile.
+    //   live.Drop(me);
+    //
+    // Call Init once, before the LiveConfig is shared, and load the first config before any reader registers. After that,
+    // Reload* may be called from any thread. A failed reload leaves the current config in place. The containers are
+    // decoded and classified before they're published and must only be read.
+    struct LiveConfig
+    {
+        struct LiveState *state;
+
+        bool         Init();
+        bool         Reload( const char *source, size_t len, eFileType type ); // Copies 'source'.
+        bool         ReloadFile( const char *path, eFileType type, const char *cache_dir = nullptr ); // See Container::ParseFile.
+
+        // Returns straight away, the file is parsed on a background thread. Requests made while one is being parsed
+        // are coalesced: only the latest is loaded next. Without threads (CFGPARSE_NO_THREADS) it's ReloadFile.
+        bool         ReloadFileAsync( const char *path, eFileType type, const char *cache_dir = nullptr );
+        unsigned int Register(); // CFG_LIVE_NO_READER once CFG_LIVE_READERS_MAX readers are registered.
+        void         Unregister( unsigned int reader );
+        Container   *Acquire( unsigned int reader );
+        void         Drop( unsigned int reader );
+        void         Reclaim();
+        void         Release(); // Only once no reader is left.
     };
 }
+
+// Field list expansion for CFG_BIND.
+#define CFG_EXPAND(x) x
+#define CFG_FE_1(m, s, x) m(s, x)
+#define CFG_FE_2(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_1(m, s, __VA_ARGS__))
+#define CFG_FE_3(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_2(m, s, __VA_ARGS__))
+#define CFG_FE_4(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_3(m, s, __VA_ARGS__))
+#define CFG_FE_5(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_4(m, s, __VA_ARGS__))
+#define CFG_FE_6(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_5(m, s, __VA_ARGS__))
+#define CFG_FE_7(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_6(m, s, __VA_ARGS__))
+#define CFG_FE_8(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_7(m, s, __VA_ARGS__))
+#define CFG_FE_9(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_8(m, s, __VA_ARGS__))
+#define CFG_FE_10(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_9(m, s, __VA_ARGS__))
+#define CFG_FE_11(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_10(m, s, __VA_ARGS__))
+#define CFG_FE_12(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_11(m, s, __VA_ARGS__))
+#define CFG_FE_13(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_12(m, s, __VA_ARGS__))
+#define CFG_FE_14(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_13(m, s, __VA_ARGS__))
+#define CFG_FE_15(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_14(m, s, __VA_ARGS__))
+#define CFG_FE_16(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_15(m, s, __VA_ARGS__))
+#define CFG_FE_17(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_16(m, s, __VA_ARGS__))
+#define CFG_FE_18(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_17(m, s, __VA_ARGS__))
+#define CFG_FE_19(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_18(m, s, __VA_ARGS__))
+#define CFG_FE_20(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_19(m, s, __VA_ARGS__))
+#define CFG_FE_21(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_20(m, s, __VA_ARGS__))
+#define CFG_FE_22(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_21(m, s, __VA_ARGS__))
+#define CFG_FE_23(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_22(m, s, __VA_ARGS__))
+#define CFG_FE_24(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_23(m, s, __VA_ARGS__))
+#define CFG_FE_25(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_24(m, s, __VA_ARGS__))
+#define CFG_FE_26(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_25(m, s, __VA_ARGS__))
+#define CFG_FE_27(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_26(m, s, __VA_ARGS__))
+#define CFG_FE_28(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_27(m, s, __VA_ARGS__))
+#define CFG_FE_29(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_28(m, s, __VA_ARGS__))
+#define CFG_FE_30(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_29(m, s, __VA_ARGS__))
+#define CFG_FE_31(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_30(m, s, __VA_ARGS__))
+#define CFG_FE_32(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_31(m, s, __VA_ARGS__))
+#define CFG_FE_33(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_32(m, s, __VA_ARGS__))
+#define CFG_FE_34(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_33(m, s, __VA_ARGS__))
+#define CFG_FE_35(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_34(m, s, __VA_ARGS__))
+#define CFG_FE_36(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_35(m, s, __VA_ARGS__))
+#define CFG_FE_37(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_36(m, s, __VA_ARGS__))
+#define CFG_FE_38(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_37(m, s, __VA_ARGS__))
+#define CFG_FE_39(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_38(m, s, __VA_ARGS__))
+#define CFG_FE_40(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_39(m, s, __VA_ARGS__))
+#define CFG_FE_41(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_40(m, s, __VA_ARGS__))
+#define CFG_FE_42(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_41(m, s, __VA_ARGS__))
+#define CFG_FE_43(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_42(m, s, __VA_ARGS__))
+#define CFG_FE_44(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_43(m, s, __VA_ARGS__))
+#define CFG_FE_45(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_44(m, s, __VA_ARGS__))
+#define CFG_FE_46(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_45(m, s, __VA_ARGS__))
+#define CFG_FE_47(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_46(m, s, __VA_ARGS__))
+#define CFG_FE_48(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_47(m, s, __VA_ARGS__))
+#define CFG_FE_49(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_48(m, s, __VA_ARGS__))
+#define CFG_FE_50(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_49(m, s, __VA_ARGS__))
+#define CFG_FE_51(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_50(m, s, __VA_ARGS__))
+#define CFG_FE_52(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_51(m, s, __VA_ARGS__))
+#define CFG_FE_53(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_52(m, s, __VA_ARGS__))
+#define CFG_FE_54(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_53(m, s, __VA_ARGS__))
+#define CFG_FE_55(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_54(m, s, __VA_ARGS__))
+#define CFG_FE_56(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_55(m, s, __VA_ARGS__))
+#define CFG_FE_57(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_56(m, s, __VA_ARGS__))
+#define CFG_FE_58(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_57(m, s, __VA_ARGS__))
+#define CFG_FE_59(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_58(m, s, __VA_ARGS__))
+#define CFG_FE_60(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_59(m, s, __VA_ARGS__))
+#define CFG_FE_61(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_60(m, s, __VA_ARGS__))
+#define CFG_FE_62(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_61(m, s, __VA_ARGS__))
+#define CFG_FE_63(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_62(m, s, __VA_ARGS__))
+#define CFG_FE_64(m, s, x, ...) m(s, x) CFG_EXPAND(CFG_FE_63(m, s, __VA_ARGS__))
+#define CFG_FE_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, _33, _34, _35, _36, _37, _38, _39, _40, _41, _42, _43, _44, _45, _46, _47, _48, _49, _50, _51, _52, _53, _54, _55, _56, _57, _58, _59, _60, _61, _62, _63, _64, NAME, ...) NAME
+#define CFG_FOR_EACH(m, s, ...) CFG_EXPAND(CFG_FE_PICK(__VA_ARGS__, CFG_FE_64, CFG_FE_63, CFG_FE_62, CFG_FE_61, CFG_FE_60, CFG_FE_59, CFG_FE_58, CFG_FE_57, CFG_FE_56, CFG_FE_55, CFG_FE_54, CFG_FE_53, CFG_FE_52, CFG_FE_51, CFG_FE_50, CFG_FE_49, CFG_FE_48, CFG_FE_47, CFG_FE_46, CFG_FE_45, CFG_FE_44, CFG_FE_43, CFG_FE_42, CFG_FE_41, CFG_FE_40, CFG_FE_39, CFG_FE_38, CFG_FE_37, CFG_FE_36, CFG_FE_35, CFG_FE_34, CFG_FE_33, CFG_FE_32, CFG_FE_31, CFG_FE_30, CFG_FE_29, CFG_FE_28, CFG_FE_27, CFG_FE_26, CFG_FE_25, CFG_FE_24, CFG_FE_23, CFG_FE_22, CFG_FE_21, CFG_FE_20, CFG_FE_19, CFG_FE_18, CFG_FE_17, CFG_FE_16, CFG_FE_15, CFG_FE_14, CFG_FE_13, CFG_FE_12, CFG_FE_11, CFG_FE_10, CFG_FE_9, CFG_FE_8, CFG_FE_7, CFG_FE_6, CFG_FE_5, CFG_FE_4, CFG_FE_3, CFG_FE_2, CFG_FE_1)(m, s, __VA_ARGS__))
+
+#define CFG_BIND_FIELD(type, field) \
+    cfg::Field{ cfg::Key{ #field, sizeof(#field) - 1, cfg::HashString(#field, sizeof(#field) - 1) }, offsetof(type, field), &cfg::FieldReader<decltype(type::field)>::Read },
+
+#define CFG_BIND(type, ...) \
+    template <> struct cfg::Binding<type> { \
+        static constexpr cfg::Field fields[] = { CFG_FOR_EACH(CFG_BIND_FIELD, type, __VA_ARGS__) }; \
+        static constexpr cfg::FieldTable<sizeof(fields) / sizeof(cfg::Field)> table{ fields }; \
+    };
 #endif // _CONFPARSE_H_
 
 #if defined(CFGPARSE_IMPLEMENTATION) && !defined(_CONFPARSE_CPP_)
@@ -98,947 +646,5632 @@ namespace cfg
     #define STB_SPRINTF_IMPLEMENTATION
 #endif
 #include "stb_sprintf.h"
+#include <string.h>
+#include <charconv>
+#include <limits>
+#include <math.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#if !defined(CFGPARSE_NO_THREADS)
+    #include <thread>
+    #include <mutex>
+#endif
+
+#include <stdio.h>
+#if defined(_WIN32)
+    #include <io.h>
+    #include <process.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <errno.h>
+    #include <sys/uio.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #if !defined(MAP_FIXED_NOREPLACE)
+        #define MAP_FIXED_NOREPLACE 0
+    #endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define CFG_SSE2
+    #include <emmintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
 
 cfg::malloc_t  cfg::cbk::malloc = ::malloc;
 cfg::realloc_t cfg::cbk::realloc = ::realloc;
 cfg::free_t    cfg::cbk::free = ::free;
 
-#define CFG_PRINT_TABS(buf, num) for (auto i = num; i != 0; --i) { *buf = '\t'; ++buf; }
 #define CFG_IS_LETTER(c) ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
 #define CFG_IS_NUMBER(c) (c >= '0' && c <= '9')
 #define CFG_IS_WHITESPACE(c) (c == ' ' || c == '\n' || c == '\r' || c == '\t')
 #define CFG_IS_SPECIAL(c) (!CFG_IS_LETTER(c) && CFG_IS_NUMBER(c) && CFG_IS_WHITESPACE(c))
 #define CFG_SIZE(s, e) ((e - s) + 1)
 
-/// --- Attribute --- ///
-cfg::Node *cfg::Node::GetSibling(char *name) {
-    auto s = next;
-    while (s) {
-        if (cfg::StringCompare(name, s->name))
-            return s;
-        s = s->next;
-    }
-    return nullptr;
+// Stores a name in the parse stack and records its length and hash on the node.
+inline void StoreNodeName( cfg::Node *node, char *&stack, const char *src, size_t len ) {
+    memcpy(stack, src, len);
+    stack[len] = 0;
+    node->name = stack;
+    node->name_len = (unsigned int)len;
+    node->name_hash = cfg::HashString(src, len);
+    stack += len + 1;
 }
 
-/// ---- Node ---- ///
-cfg::Node *cfg::Node::GetAttribute(char *name) {
-    auto a = first_attribute;
-    while (a) {
-        if (cfg::StringCompare(name, a->name))
-            return a;
-        a = a->next;
+cfg::Node *FindNode( cfg::Node *first, const char *name, unsigned int len, unsigned int hash ) {
+    for (auto n = first; n; n = n->next) {
+        if (n->NameEquals(name, len, hash))
+            return n;
     }
     return nullptr;
 }
 
-cfg::Node *cfg::Node::GetChild(char *name, unsigned int depth) {
-    auto c = first_child;
-    while (c) {
-        if (cfg::StringCompare(name, c->name))
+cfg::Node *FindChild( cfg::Node *first, const char *name, unsigned int len, unsigned int hash, unsigned int depth ) {
+    for (auto c = first; c; c = c->next) {
+        if (c->NameEquals(name, len, hash))
             return c;
         if (depth) {
-            auto r = c->GetChild(name, depth - 1);
-            if (r) 
+            auto r = FindChild(c->first_child, name, len, hash, depth - 1);
+            if (r)
                 return r;
         }
-        c = c->next;
     }
     return nullptr;
 }
 
-cfg::Node *cfg::Node::GetChild( unsigned int idx ) {
-    for ( auto c = first_child; c; c = c->next ) {
-        if ( idx == 0 )
-            return c;
-    }
-    return nullptr;
+// Arrays are flagged by the JSON, CBOR and MessagePack parsers; built trees mark them with unnamed children.
+bool IsJsonArray( cfg::Node *n ) {
+    return (n->flags & cfg::eNodeFlag_Array) || (n->first_child && !n->first_child->name);
 }
 
-cfg::Container *g_curr_container;
-char *g_curr_dst_buffer;
-
-// ---- Forward for simplicity
-#if !defined(CFGPARSE_ALL)
-#if !defined(CFGPARSE_INI)
-bool ParseIni( cfg::Container *ctn, char *source, size_t len ) { return false; }
-size_t PrintIni( cfg::Container *ctn, char **dst ) { return 0; }
-#endif // CFGPARSE_INI
-#if !defined(CFGPARSE_JSON)
-bool ParseJson( cfg::Container *ctn, char *source, size_t len ) { return false; }
-size_t PrintJson( cfg::Container *ctn, char **dst ) { return 0; }
-#endif // CFGPARSE_JSON
-#if !defined(CFGPARSE_XML)
-bool ParseXml( cfg::Container *ctn, char *source, size_t len ) { return false; }
-size_t PrintXml( cfg::Container *ctn, char **dst ) { return 0; }
-#endif // CFGPARSE_XML
-#if !defined(CFGPARSE_JSON)
-bool ParseYaml( cfg::Container *ctn, char *source, size_t len ) { return false; }
-size_t PrintYaml( cfg::Container *ctn, char **dst ) { return 0; }
-#endif // CFGPARSE_JSON
-#endif // CFGPARSE_ALL
-
-#if defined(CFGPARSE_INI) || defined(CFGPARSE_ALL)
-bool ParseIni(cfg::Container *ctn, char *source, size_t len) {
-	auto c = source;
-	auto tmp = c;
-
-	size_t total_size = 0;
+// Finds many names in one pass over a sibling list. The requested names are hashed into a small table with twice
+// as many slots as names, names that land in the same slot are chained. Building it is one pass over the names,
+// and each sibling costs one multiply and usually one compare.
+unsigned int FindNodes( cfg::Node *first, char **names, cfg::Node **out, unsigned int count ) {
+    unsigned int found = 0;
+
+    while (count) {
+        unsigned int n = (count > CFG_BATCH_NAMES_MAX) ? CFG_BATCH_NAMES_MAX : count;
+
+        unsigned int lens[CFG_BATCH_NAMES_MAX];
+        unsigned int hashes[CFG_BATCH_NAMES_MAX];
+        unsigned short chain[CFG_BATCH_NAMES_MAX];      // Next name in the same slot, +1.
+        unsigned short table[CFG_BATCH_NAMES_MAX * 2];  // First name in the slot + 1, 0 for empty.
+
+        unsigned int bits = 1;
+        while ((1u << bits) < (n * 2))
+            ++bits;
+        memset(table, 0, sizeof(unsigned short) << bits);
+
+        for (unsigned int i = 0; i < n; ++i) {
+            lens[i] = (unsigned int)cfg::StringLength(names[i]);
+            hashes[i] = cfg::HashString(names[i], lens[i]);
+            out[i] = nullptr;
+
+            unsigned int slot = (hashes[i] * 2654435761u) >> (32 - bits);
+            chain[i] = table[slot];
+            table[slot] = (unsigned short)(i + 1);
+        }
 
-	// Measure strings.
-	while (*c) {
-		if (*c == '[') {
-			total_size += sizeof(cfg::Node);
-			
-			++c;
-			tmp = c;
-			while (*c != ']') ++ c;
-			total_size += (c - tmp) + 1;
-		}
-		else if (*c == '=') {
-			total_size += sizeof(cfg::Node);
+        unsigned int remaining = n;
+        for (auto s = first; s && remaining; s = s->next) {
+            if (!s->name)
+                continue;
+            unsigned int j = table[(s->name_hash * 2654435761u) >> (32 - bits)];
+            while (j) {
+                auto i = j - 1;
+                if (!out[i] && s->NameEquals(names[i], lens[i], hashes[i])) {
+                    out[i] = s;
+                    --remaining;
+                }
+                j = chain[i];
+            }
+        }
 
-			--c;
-			while (*c == ' ') --c;
-			tmp = c + 1;
-			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_') --c;
-			++c;
-			total_size += (tmp - c) + 1;
+        for (unsigned int i = 0; i < n; ++i) {
+            if (out[i])
+                ++found;
+        }
 
-			while (*c != '=') ++c;
-			++c;
-			while (*c == ' ') ++c;
-			tmp = c;
+        names += n;
+        out += n;
+        count -= n;
+    }
 
-			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_' || *c == '-' || *c == '.') ++c;
-			total_size += (c - tmp) + 1;
-		}
+    return found;
+}
 
-		++c;
-	}
+/// --- Attribute --- ///
+cfg::Node *cfg::Node::GetSibling(char *name) {
+    auto len = (unsigned int)cfg::StringLength(name);
+    return FindNode(next, name, len, cfg::HashString(name, len));
+}
 
-	if (total_size == 0)
-		return false;
+/// ---- Node ---- ///
+cfg::Node *cfg::Node::GetAttribute(char *name) {
+    auto len = (unsigned int)cfg::StringLength(name);
+    return FindNode(first_attribute, name, len, cfg::HashString(name, len));
+}
 
-	// Allocate
-	ctn->base_heap.base = (char *)cfg::cbk::malloc(total_size);
-	memset(ctn->base_heap.base, 0, total_size);
+cfg::Node *cfg::Node::GetChild(Key key, unsigned int depth) {
+    return FindChild(first_child, key.name, key.len, key.hash, depth);
+}
 
-	ctn->base_heap.free = ctn->base_heap.base;
-	char *&stack = ctn->base_heap.free;
+cfg::Node *cfg::Node::GetAttribute(Key key) {
+    return FindNode(first_attribute, key.name, key.len, key.hash);
+}
 
-	ctn->first = nullptr;
+cfg::Node *cfg::Node::GetSibling(Key key) {
+    return FindNode(next, key.name, key.len, key.hash);
+}
 
-	// Copy strings.
-	c = source;
-	tmp = c;
-    cfg::Node *active_section = nullptr;
-    cfg::Node *active_value = nullptr;
+unsigned int cfg::Node::GetChildren(char **names, Node **out, unsigned int count) {
+    return FindNodes(first_child, names, out, count);
+}
 
-	while (*c) {
-		if (*c == '[') {
-            auto section = (cfg::Node *)stack;
-			stack += sizeof(cfg::Node);
+unsigned int cfg::Node::GetAttributes(char **names, Node **out, unsigned int count) {
+    return FindNodes(first_attribute, names, out, count);
+}
 
-			++c;
-			tmp = c;
+cfg::Node *cfg::Node::GetChild(char *name, unsigned int depth) {
+    auto len = (unsigned int)cfg::StringLength(name);
+    return FindChild(first_child, name, len, cfg::HashString(name, len), depth);
+}
 
-			while (*c != ']') ++c;
-			memcpy(stack, tmp, (c - tmp));
-			section->name = stack;
-			stack += (c - tmp) + 1;
+cfg::Node *cfg::Node::GetChild( unsigned int idx ) {
+    if ( flags & cfg::eNodeFlag_PackedChildren )
+        return ( idx < child_count ) ? &first_child[idx] : nullptr;
 
-			if (!ctn->first)
-				ctn->first = section;
-			if (active_section)
-				active_section->next = section;
-			active_section = section;
-		}
-		else if (*c == '=') {
-			auto val = (cfg::Node *)stack;
-			stack += sizeof(cfg::Node);
+    for ( auto c = first_child; c; c = c->next ) {
+        if ( idx == 0 )
+            return c;
+        --idx;
+    }
+    return nullptr;
+}
 
-			--c;
-			while (*c == ' ') --c;
-			tmp = (c + 1);
+unsigned int cfg::Node::ChildCount() {
+    if ( flags & cfg::eNodeFlag_PackedChildren )
+        return child_count;
 
-			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_') --c;
-			++c;
+    unsigned int count = 0;
+    for ( auto c = first_child; c; c = c->next )
+        ++count;
+    return count;
+}
 
-			memcpy(stack, c, (tmp - c));
-			val->name = stack;
-			stack += (tmp - c) + 1;
+/// ---- Numbers ---- ///
+// std::from_chars is exact, locale independent and reports overflow, unlike atoi/atof.
+// It doesn't accept leading whitespace or a '+', so those are skipped here.
+const char *SkipNumberPrefix( const char *c ) {
+    while (CFG_IS_WHITESPACE(*c)) ++c;
+    if (*c == '+' && *(c + 1) != '-')
+        ++c;
+    return c;
+}
 
-			while (*c != '=') ++c;
-			++c;
-			while (*c == ' ') ++c;
+template <typename T>
+bool ParseNumber( const char *str, T *out, bool whole ) {
+    if (!str)
+        return false;
 
-			tmp = c;
-			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_' || *c == '-' || *c == '.') ++c;
-			memcpy(stack, tmp, (c - tmp));
-			val->str = stack;
-			stack += (c - tmp) + 1;
+    auto begin = SkipNumberPrefix(str);
+    auto end = begin + cfg::StringLength((char *)begin);
+    auto r = std::from_chars(begin, end, *out);
+    if (r.ec != std::errc())
+        return false;
+    return !whole || r.ptr == end;
+}
 
-			if (!active_section->first_attribute)
-				active_section->first_attribute = val;
-			if (active_value)
-				active_value->next = val;
-			active_value = val;
-		}
+bool MatchLiteral( const char *str, const char *lit ) {
+    while (*lit) {
+        if (*str != *lit)
+            return false;
+        ++str;
+        ++lit;
+    }
+    return *str == 0;
+}
 
-		++c;
-	}
+cfg::eValueType ClassifyString( const char *str, cfg::Node::Scalar *v ) {
+    if (!str)
+        return cfg::eValueType_None;
 
-	// Setup heap for user-made allocations.
-	ctn->base_heap.next = (cfg::Heap *)cfg::cbk::malloc(sizeof(cfg::Heap) + CFG_HEAP_SIZE);
-	ctn->heap = ctn->base_heap.next;
-	ctn->heap->base = (char *)(((uintptr_t)ctn->heap) + sizeof(cfg::Heap));
-    ctn->heap->ceiling = (ctn->heap->base) + CFG_HEAP_SIZE;
-	ctn->heap->free = ctn->heap->base;
-	ctn->heap->next = nullptr;
+    switch (*str) {
+        case 't': if (MatchLiteral(str, "true")) { v->b = true; return cfg::eValueType_Bool; } return cfg::eValueType_String;
+        case 'f': if (MatchLiteral(str, "false")) { v->b = false; return cfg::eValueType_Bool; } return cfg::eValueType_String;
+        case 'n': if (MatchLiteral(str, "null")) return cfg::eValueType_Null; return cfg::eValueType_String;
+    }
 
-    ctn->file_type = cfg::eFileType_Ini;
-    return true;
+    // Cheap rejection before any number parsing.
+    if (!CFG_IS_NUMBER(*str) && !CFG_IS_WHITESPACE(*str) && *str != '-' && *str != '+' && *str != '.')
+        return cfg::eValueType_String;
+
+    if (ParseNumber(str, &v->i, true))
+        return cfg::eValueType_Integer;
+    if (ParseNumber(str, &v->u, true))
+        return cfg::eValueType_Unsigned;
+    if (ParseNumber(str, &v->f, true))
+        return cfg::eValueType_Float;
+    return cfg::eValueType_String;
 }
 
-size_t PrintIni(cfg::Container *ctn, char **dst) {
-    // Measure
-    size_t total = 1; // \0
-    size_t tmp = 0;
-
-    for (auto s = ctn->first; s; s = s->next) {
-        total += cfg::StringLength(s->name) + 4; // [*name*]\n*attributes*\n
+// The cached scalar if the node has been classified, otherwise a classification that isn't stored.
+cfg::eValueType GetScalar( cfg::Node *n, cfg::Node::Scalar *v ) {
+    if (n->value_type != cfg::eValueType_Unknown) {
+        *v = n->value;
+        return n->value_type;
+    }
+    return ClassifyString(n->str, v);
+}
 
-        for (auto a = s->first_attribute; a; a = a->next) {
-            total += cfg::StringLength(a->name) + cfg::StringLength(a->str) + 2; // *name*=*str*\n
+template <typename T>
+bool ScalarToInteger( cfg::eValueType type, cfg::Node::Scalar v, T *out ) {
+    switch (type) {
+        case cfg::eValueType_Integer:
+            if (v.i < (int64_t)std::numeric_limits<T>::min())
+                return false;
+            if (v.i > 0 && (uint64_t)v.i > (uint64_t)std::numeric_limits<T>::max())
+                return false;
+            *out = (T)v.i;
+            return true;
+        case cfg::eValueType_Unsigned:
+            if (v.u > (uint64_t)std::numeric_limits<T>::max())
+                return false;
+            *out = (T)v.u;
+            return true;
+        case cfg::eValueType_Float:
+        {
+            // Truncation, only reached from the As* accessors. 'hi' is an exact power of two; NaN fails both tests.
+            double lo = (double)std::numeric_limits<T>::min() - 1.0;
+            double hi = ((double)(std::numeric_limits<T>::max() / 2 + 1)) * 2.0;
+            if (!(v.f > lo && v.f < hi))
+                return false;
+            *out = (T)v.f;
+            return true;
         }
+        default:
+            return false;
     }
+}
 
-    *dst = (char *)cfg::cbk::malloc(total);
-    memset(*dst, 0, total);
+template <typename T>
+bool ScalarToFloat( cfg::eValueType type, cfg::Node::Scalar v, T *out ) {
+    switch (type) {
+        case cfg::eValueType_Integer:  *out = (T)v.i; return true;
+        case cfg::eValueType_Unsigned: *out = (T)v.u; return true;
+        case cfg::eValueType_Float:
+            // Narrowing a finite double that doesn't fit is undefined, infinities and NaN carry over.
+            if (std::isfinite(v.f) && (v.f > std::numeric_limits<T>::max() || v.f < -std::numeric_limits<T>::max()))
+                return false;
+            *out = (T)v.f;
+            return true;
+        default: return false;
+    }
+}
 
-    auto c = *dst;
+void cfg::Node::Classify() {
+    // Attached arrays are already typed.
+    if (value_type >= eValueType_Int32Array)
+        return;
+    value_type = ClassifyString(GetString(), &value);
+}
 
-    for (auto s = ctn->first; s; s = s->next) {
-        *c = '[';
-        ++c;
+cfg::eValueType cfg::Node::Type() {
+    Scalar v;
+    return GetScalar(this, &v);
+}
 
-        tmp = cfg::StringLength(s->name);
-        memcpy(c, s->name, tmp);
-        c += tmp;
-        
-        *c = ']';
-        *(c + 1) = '\n';
-        c += 2;
+int64_t cfg::Node::AsInt64() {
+    Scalar v;
+    int64_t r = 0;
+    auto type = GetScalar(this, &v);
+    if (type == eValueType_String)
+        return ParseNumber(str, &r, false) ? r : 0;
+    return ScalarToInteger(type, v, &r) ? r : 0;
+}
 
-        for (auto a = s->first_attribute; a; a = a->next) {
-            tmp = cfg::StringLength(a->name);
-            memcpy(c, a->name, tmp);
-            c += tmp;
+uint64_t cfg::Node::AsUInt64() {
+    Scalar v;
+    uint64_t r = 0;
+    auto type = GetScalar(this, &v);
+    if (type == eValueType_String)
+        return ParseNumber(str, &r, false) ? r : 0;
+    return ScalarToInteger(type, v, &r) ? r : 0;
+}
 
-            *c = '=';
-            ++c;
+double cfg::Node::AsDouble() {
+    Scalar v;
+    double r = 0;
+    auto type = GetScalar(this, &v);
+    if (type == eValueType_String)
+        return ParseNumber(str, &r, false) ? r : 0;
+    return ScalarToFloat(type, v, &r) ? r : 0;
+}
 
-            tmp = cfg::StringLength(a->str);
-            memcpy(c, a->str, tmp);
-            c += tmp;
-            
-            *c = '\n';
-            ++c;
-        }
+// Narrowed with the same range checks as TryAs, so a value that doesn't fit is 0 rather than wrapped.
+int cfg::Node::AsInteger() {
+    Scalar v;
+    int r = 0;
+    v.i = AsInt64();
+    return ScalarToInteger(eValueType_Integer, v, &r) ? r : 0;
+}
 
-        *c = '\n';
-        ++c;
+float cfg::Node::AsFloat() {
+    Scalar v;
+    float r = 0;
+    v.f = AsDouble();
+    return ScalarToFloat(eValueType_Float, v, &r) ? r : 0;
+}
+
+template <typename T>
+bool TryAsInteger( cfg::Node *n, T *out ) {
+    cfg::Node::Scalar v;
+    auto type = GetScalar(n, &v);
+    if (type != cfg::eValueType_Integer && type != cfg::eValueType_Unsigned)
+        return false;
+    return ScalarToInteger(type, v, out);
+}
+
+template <typename T>
+bool TryAsFloat( cfg::Node *n, T *out ) {
+    cfg::Node::Scalar v;
+    return ScalarToFloat(GetScalar(n, &v), v, out);
+}
+
+template <> bool cfg::Node::TryAs<int>( int &out ) { return TryAsInteger(this, &out); }
+template <> bool cfg::Node::TryAs<unsigned int>( unsigned int &out ) { return TryAsInteger(this, &out); }
+template <> bool cfg::Node::TryAs<int64_t>( int64_t &out ) { return TryAsInteger(this, &out); }
+template <> bool cfg::Node::TryAs<uint64_t>( uint64_t &out ) { return TryAsInteger(this, &out); }
+template <> bool cfg::Node::TryAs<float>( float &out ) { return TryAsFloat(this, &out); }
+template <> bool cfg::Node::TryAs<double>( double &out ) { return TryAsFloat(this, &out); }
+
+/// ---- Escapes ---- ///
+// Strings are stored exactly as they appear in the source. Parsers flag the few that contain escapes
+// (eNodeFlag_JsonEscaped / eNodeFlag_XmlEscaped) and they're decoded in place on first access; decoding
+// never makes a string longer. Printing the same format copies still-escaped strings straight back out.
+
+#if defined(CFG_SSE2)
+inline unsigned int CountTrailingZeros( unsigned int v ) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, v);
+    return (unsigned int)idx;
+#else
+    return (unsigned int)__builtin_ctz(v);
+#endif
+}
+#endif
+
+// Finds the closing quote of a JSON string. 'c' is just past the opening quote, the result is on the closing
+// quote (or the terminator). Sixteen bytes are checked at a time for '"', '\' and '\0'; '*escaped' is set if a
+// backslash is seen.
+char *ScanJsonString( char *c, const char *end, bool *escaped ) {
+#if defined(CFG_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+
+    while (c + 16 <= end) {
+        __m128i v = _mm_loadu_si128((const __m128i *)c);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)), _mm_cmpeq_epi8(v, zero));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (!mask) {
+            c += 16;
+            continue;
+        }
+
+        c += CountTrailingZeros(mask);
+        if (*c != '\\')
+            return c;
+        *escaped = true;
+        if (c + 1 >= end)
+            return c + 1; // A trailing backslash, same as the scalar loop.
+        c += 2;
+    }
+#endif
+
+    while (*c && *c != '"') {
+        if (*c == '\\') {
+            *escaped = true;
+            if (!*(c + 1))
+                return c + 1;
+            ++c;
+        }
+        ++c;
+    }
+    return c;
+}
+
+size_t EncodeUtf8( char *dst, unsigned int cp ) {
+    if (cp < 0x80) {
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        dst[0] = (char)(0xE0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | (cp >> 18));
+    dst[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+bool ParseHexDigits( const char *c, const char *end, unsigned int digits, unsigned int *out ) {
+    if (end - c < (ptrdiff_t)digits)
+        return false;
+    unsigned int v = 0;
+    for (unsigned int i = 0; i < digits; ++i) {
+        char h = c[i];
+        v <<= 4;
+        if (h >= '0' && h <= '9') v |= (h - '0');
+        else if (h >= 'a' && h <= 'f') v |= (h - 'a' + 10);
+        else if (h >= 'A' && h <= 'F') v |= (h - 'A' + 10);
+        else return false;
+    }
+    *out = v;
+    return true;
+}
+
+// Decodes JSON escapes from 'src' into 'dst' (which may be 'src'). Returns the decoded length.
+size_t DecodeJsonString( char *dst, const char *src, size_t len ) {
+    auto end = src + len;
+    auto d = dst;
+
+    while (src < end) {
+        if (*src != '\\') {
+            *d = *src;
+            ++d;
+            ++src;
+            continue;
+        }
+
+        ++src;
+        if (src >= end)
+            break;
+        char e = *src;
+        ++src;
+
+        switch (e) {
+            case 'b': *d = '\b'; ++d; break;
+            case 'f': *d = '\f'; ++d; break;
+            case 'n': *d = '\n'; ++d; break;
+            case 'r': *d = '\r'; ++d; break;
+            case 't': *d = '\t'; ++d; break;
+            case 'u': {
+                unsigned int cp;
+                if (!ParseHexDigits(src, end, 4, &cp)) {
+                    *d = 'u';
+                    ++d;
+                    break;
+                }
+                src += 4;
+
+                // Surrogate pairs, lone surrogates become U+FFFD.
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned int lo;
+                    if ((end - src) >= 6 && src[0] == '\\' && src[1] == 'u' && ParseHexDigits(src + 2, end, 4, &lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        src += 6;
+                    }
+                    else {
+                        cp = 0xFFFD;
+                    }
+                }
+                else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = 0xFFFD;
+                }
+                d += EncodeUtf8(d, cp);
+            } break;
+            default: *d = e; ++d; break; // '"', '\', '/'
+        }
+    }
+    return d - dst;
+}
+
+// Decodes the predefined XML entities and character references. Unknown entities are kept as-is.
+size_t DecodeXmlEntities( char *dst, const char *src, size_t len ) {
+    auto end = src + len;
+    auto d = dst;
+
+    while (src < end) {
+        if (*src != '&') {
+            *d = *src;
+            ++d;
+            ++src;
+            continue;
+        }
+
+        auto semi = src + 1;
+        while (semi < end && *semi != ';' && (semi - src) < 12) ++semi;
+        if (semi >= end || *semi != ';') {
+            *d = *src;
+            ++d;
+            ++src;
+            continue;
+        }
+
+        auto name = src + 1;
+        size_t name_len = semi - name;
+        unsigned int cp = 0;
+        bool ok = true;
+
+        if (name_len == 3 && memcmp(name, "amp", 3) == 0) cp = '&';
+        else if (name_len == 2 && memcmp(name, "lt", 2) == 0) cp = '<';
+        else if (name_len == 2 && memcmp(name, "gt", 2) == 0) cp = '>';
+        else if (name_len == 4 && memcmp(name, "quot", 4) == 0) cp = '"';
+        else if (name_len == 4 && memcmp(name, "apos", 4) == 0) cp = '\'';
+        else if (name_len > 2 && name[0] == '#' && (name[1] == 'x' || name[1] == 'X'))
+            ok = (name_len - 2) <= 6 && ParseHexDigits(name + 2, semi, (unsigned int)(name_len - 2), &cp);
+        else if (name_len > 1 && name[0] == '#') {
+            for (auto n = name + 1; ok && n < semi; ++n) {
+                ok = CFG_IS_NUMBER(*n);
+                cp = (cp * 10) + (*n - '0');
+            }
+            ok = ok && (name_len - 1) <= 7;
+        }
+        else
+            ok = false;
+
+        if (!ok || cp > 0x10FFFF) {
+            *d = *src;
+            ++d;
+            ++src;
+            continue;
+        }
+
+        d += EncodeUtf8(d, cp);
+        src = semi + 1;
+    }
+    return d - dst;
+}
+
+// Anything that has to be escaped by either printer.
+bool StringNeedsEscape( const char *str ) {
+    for (auto c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\' || *c == '<' || *c == '>' || *c == '&' || *c == '\'' || (unsigned char)*c < 0x20)
+            return true;
+    }
+    return false;
+}
+
+char *cfg::Node::GetString() {
+    if (!(flags & (eNodeFlag_JsonEscaped | eNodeFlag_XmlEscaped)) || !str)
+        return str;
+
+    size_t len = cfg::StringLength(str);
+    if (flags & eNodeFlag_JsonEscaped)
+        len = DecodeJsonString(str, str, len);
+    else
+        len = DecodeXmlEntities(str, str, len);
+    str[len] = 0;
+
+    flags &= ~(eNodeFlag_JsonEscaped | eNodeFlag_XmlEscaped);
+    if (StringNeedsEscape(str))
+        flags |= eNodeFlag_NeedsEscape;
+    return str;
+}
+
+size_t JsonEscapedLength( const char *str ) {
+    size_t len = 0;
+    for (auto c = str; *c; ++c) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch == '"' || ch == '\\' || ch == '\b' || ch == '\f' || ch == '\n' || ch == '\r' || ch == '\t') len += 2;
+        else if (ch < 0x20) len += 6;
+        else len += 1;
+    }
+    return len;
+}
+
+char *WriteJsonEscaped( char *c, const char *str ) {
+    for (auto s = str; *s; ++s) {
+        unsigned char ch = (unsigned char)*s;
+        char e = 0;
+        switch (ch) {
+            case '"':  e = '"'; break;
+            case '\\': e = '\\'; break;
+            case '\b': e = 'b'; break;
+            case '\f': e = 'f'; break;
+            case '\n': e = 'n'; break;
+            case '\r': e = 'r'; break;
+            case '\t': e = 't'; break;
+        }
+        if (e) {
+            c[0] = '\\';
+            c[1] = e;
+            c += 2;
+        }
+        else if (ch < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            c[0] = '\\'; c[1] = 'u'; c[2] = '0'; c[3] = '0';
+            c[4] = hex[ch >> 4];
+            c[5] = hex[ch & 15];
+            c += 6;
+        }
+        else {
+            *c = (char)ch;
+            ++c;
+        }
+    }
+    return c;
+}
+
+size_t XmlEscapedLength( const char *str ) {
+    size_t len = 0;
+    for (auto c = str; *c; ++c) {
+        switch (*c) {
+            case '&':  len += 5; break;
+            case '<':
+            case '>':  len += 4; break;
+            case '"':
+            case '\'': len += 6; break;
+            default:   len += 1; break;
+        }
+    }
+    return len;
+}
+
+char *WriteXmlEscaped( char *c, const char *str ) {
+    for (auto s = str; *s; ++s) {
+        const char *e = nullptr;
+        switch (*s) {
+            case '&':  e = "&amp;"; break;
+            case '<':  e = "&lt;"; break;
+            case '>':  e = "&gt;"; break;
+            case '"':  e = "&quot;"; break;
+            case '\'': e = "&apos;"; break;
+        }
+        if (!e) {
+            *c = *s;
+            ++c;
+            continue;
+        }
+        while (*e) {
+            *c = *e;
+            ++c;
+            ++e;
+        }
+    }
+    return c;
+}
+
+/// ---- Editing ---- ///
+// New nodes and copies of their names and strings come from the container's growth heap and are released
+// with it. Removing a node unlinks it, its memory stays in the heap until then.
+char *CopyToHeap( cfg::Container *ctn, const char *str ) {
+    size_t len = strlen(str);
+    auto copy = (char *)ctn->Allocate(len + 1);
+    if (copy)
+        memcpy(copy, str, len + 1);
+    return copy;
+}
+
+bool StoreEditedName( cfg::Container *ctn, cfg::Node *node, const char *name ) {
+    auto copy = CopyToHeap(ctn, name);
+    if (!copy)
+        return false;
+    node->name = copy;
+    node->name_len = (unsigned int)strlen(copy);
+    node->name_hash = cfg::HashString(copy, node->name_len);
+    node->flags &= ~cfg::eNodeFlag_NameEscape;
+    if (StringNeedsEscape(copy))
+        node->flags |= cfg::eNodeFlag_NameEscape;
+    return true;
+}
+
+// Always a plain string, it's escaped when printed and classified again when asked.
+bool StoreEditedString( cfg::Container *ctn, cfg::Node *node, const char *str ) {
+    auto copy = str ? CopyToHeap(ctn, str) : nullptr;
+    if (str && !copy)
+        return false;
+    node->str = copy;
+    node->flags &= ~(cfg::eNodeFlag_JsonEscaped | cfg::eNodeFlag_XmlEscaped | cfg::eNodeFlag_NeedsEscape | cfg::eNodeFlag_Bare);
+    if (copy && StringNeedsEscape(copy))
+        node->flags |= cfg::eNodeFlag_NeedsEscape;
+    node->value_type = cfg::eValueType_Unknown;
+    return true;
+}
+
+// 'name' is nullptr for array elements.
+cfg::Node *NewNode( cfg::Container *ctn, cfg::Node *parent, const char *name, const char *str ) {
+    auto node = (cfg::Node *)ctn->Allocate(sizeof(cfg::Node));
+    if (!node)
+        return nullptr;
+    node->parent = parent;
+    if ((name && !StoreEditedName(ctn, node, name)) || (str && !StoreEditedString(ctn, node, str)))
+        return nullptr;
+    node->flags |= cfg::eNodeFlag_Dirty;
+    return node;
+}
+
+// The last node of a list. The cached tail is used while it's still the end of the list, otherwise the
+// list is walked once (after a parse, or after someone relinked it by hand).
+cfg::Node *ListTail( cfg::Node *first, cfg::Node *tail, cfg::Node *parent ) {
+    if (tail && tail->parent == parent && !tail->next)
+        return tail;
+    if (parent && (parent->flags & cfg::eNodeFlag_PackedChildren) && first == parent->first_child)
+        return parent->child_count ? &first[parent->child_count - 1] : nullptr;
+
+    auto n = first;
+    while (n && n->next)
+        n = n->next;
+    return n;
+}
+
+inline bool IsPackedChild( cfg::Node *parent, cfg::Node *n ) {
+    return parent && (parent->flags & cfg::eNodeFlag_PackedChildren) && n >= parent->first_child && n < parent->first_child + parent->child_count;
+}
+
+cfg::Node *cfg::Node::AppendChild(Container *ctn, const char *name, const char *str) {
+    // INI sections only hold keys, which are attributes (see SetAttribute).
+    if (ctn->file_type == eFileType_Ini)
+        return nullptr;
+
+    auto node = NewNode(ctn, this, name, str);
+    if (!node)
+        return nullptr;
+
+    auto tail = ListTail(first_child, last_child, this);
+    if (tail)
+        tail->next = node;
+    else
+        first_child = node;
+    last_child = node;
+    flags &= ~eNodeFlag_PackedChildren;
+
+    ctn->MarkDirty(this, true);
+    return node;
+}
+
+cfg::Node *cfg::Node::InsertAfter(Container *ctn, const char *name, const char *str) {
+    auto node = NewNode(ctn, parent, name, str);
+    if (!node)
+        return nullptr;
+
+    node->next = next;
+    next = node;
+
+    auto &tail = parent ? parent->last_child : ctn->last;
+    if (tail == this)
+        tail = node;
+    if (IsPackedChild(parent, this))
+        parent->flags &= ~eNodeFlag_PackedChildren;
+
+    ctn->MarkDirty(parent, true);
+    return node;
+}
+
+bool cfg::Node::SetName(Container *ctn, const char *name) {
+    if (!StoreEditedName(ctn, this, name))
+        return false;
+    ctn->MarkDirty(this);
+    return true;
+}
+
+bool cfg::Node::SetString(Container *ctn, const char *str) {
+    if (!StoreEditedString(ctn, this, str))
+        return false;
+    ctn->MarkDirty(this);
+    return true;
+}
+
+cfg::Node *cfg::Node::SetAttribute(Container *ctn, const char *name, const char *str) {
+    auto len = (unsigned int)strlen(name);
+    auto hash = cfg::HashString(name, len);
+
+    // One walk finds either the attribute or the end of the list.
+    Node *tail = nullptr;
+    for (auto a = first_attribute; a; a = a->next) {
+        if (a->NameEquals(name, len, hash))
+            return a->SetString(ctn, str) ? a : nullptr;
+        tail = a;
+    }
+
+    auto node = NewNode(ctn, this, name, str);
+    if (!node)
+        return nullptr;
+    if (tail)
+        tail->next = node;
+    else
+        first_attribute = node;
+
+    ctn->MarkDirty(this, true);
+    return node;
+}
+
+bool cfg::Node::Remove(Container *ctn) {
+    auto &first = parent ? parent->first_child : ctn->first;
+    auto &tail = parent ? parent->last_child : ctn->last;
+
+    // Packed siblings are found by position, everything else by walking from the front.
+    Node **link = nullptr;
+    Node *prev = nullptr;
+    if (IsPackedChild(parent, this)) {
+        prev = (this != first) ? this - 1 : nullptr;
+        link = prev ? &prev->next : &first;
+        parent->flags &= ~eNodeFlag_PackedChildren;
+    }
+    else {
+        for (link = &first; *link && *link != this; link = &(*link)->next)
+            prev = *link;
+        if (!*link && parent) {
+            prev = nullptr;
+            for (link = &parent->first_attribute; *link && *link != this; link = &(*link)->next)
+                prev = *link;
+        }
+        if (!*link)
+            return false;
+    }
+
+    *link = next;
+    if (tail == this)
+        tail = prev;
+    next = nullptr;
+
+    ctn->MarkDirty(parent, true);
+    return true;
+}
+
+cfg::Node *cfg::Container::AppendChild(const char *name, const char *str) {
+    auto node = NewNode(this, nullptr, name, str);
+    if (!node)
+        return nullptr;
+
+    auto tail = ListTail(first, last, nullptr);
+    if (tail)
+        tail->next = node;
+    else
+        first = node;
+    last = node;
+
+    MarkDirty(nullptr, true);
+    return node;
+}
+
+/// ---- Number arrays ---- ///
+#define CFG_IS_LIST_SEPARATOR(c) (CFG_IS_WHITESPACE(c) || c == ',' || c == ';' || c == '"' || c == '[' || c == ']')
+
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CFG_SWAR_DIGITS
+#endif
+
+#if defined(CFG_SWAR_DIGITS)
+// Eight ASCII digits at once (little endian), see "Parsing series of integers with SIMD" (Lemire).
+inline bool IsEightDigits( uint64_t v ) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+inline uint32_t ParseEightDigits( uint64_t v ) {
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return (uint32_t)v;
+}
+#endif
+
+bool ParseListToken( const char *&c, const char *end, int32_t *out ) {
+    bool negative = false;
+    auto start = c;
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = (*c == '-');
+        ++c;
+    }
+
+    auto digits = c;
+    uint64_t v = 0;
+#if defined(CFG_SWAR_DIGITS)
+    if (end - c >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, c, 8);
+        if (IsEightDigits(chunk)) {
+            v = ParseEightDigits(chunk);
+            c += 8;
+        }
+    }
+#endif
+    while (c < end && CFG_IS_NUMBER(*c) && (c - digits) < 11) {
+        v = (v * 10) + (*c - '0');
+        ++c;
+    }
+
+    if (c == digits || (c < end && !CFG_IS_LIST_SEPARATOR(*c))) {
+        c = start;
+        return false;
+    }
+    if (v > (negative ? 2147483648ull : 2147483647ull)) {
+        c = start;
+        return false;
+    }
+    *out = negative ? (int32_t)(0 - v) : (int32_t)v;
+    return true;
+}
+
+template <typename T>
+bool ParseListToken( const char *&c, const char *end, T *out ) {
+    auto begin = c;
+    if (begin < end && *begin == '+')
+        ++begin;
+    auto r = std::from_chars(begin, end, *out);
+    if (r.ec != std::errc() || (r.ptr < end && !CFG_IS_LIST_SEPARATOR(*r.ptr)))
+        return false;
+    c = r.ptr;
+    return true;
+}
+
+// The list kernel: separators are skipped in a tight loop and each number is converted in place.
+template <typename T>
+size_t ParseNumberList( const char *c, const char *end, T *out, size_t max ) {
+    size_t count = 0;
+    while (count < max) {
+        while (c < end && CFG_IS_LIST_SEPARATOR(*c)) ++c;
+        if (c >= end || !ParseListToken(c, end, &out[count]))
+            break;
+        ++count;
+    }
+    return count;
+}
+
+template <typename T>
+size_t CountNumberList( const char *c, const char *end ) {
+    T tmp;
+    size_t count = 0;
+    for (;;) {
+        while (c < end && CFG_IS_LIST_SEPARATOR(*c)) ++c;
+        if (c >= end || !ParseListToken(c, end, &tmp))
+            break;
+        ++count;
+    }
+    return count;
+}
+
+template <typename T, typename U>
+size_t CopyNumberArray( const U *src, size_t count, T *out, size_t max ) {
+    if (count > max)
+        count = max;
+    for (size_t i = 0; i < count; ++i) {
+        // Doubles narrowed to float are range checked like TryAs, the copy stops at the first that doesn't fit.
+        if constexpr (!std::numeric_limits<T>::is_integer && sizeof(T) < sizeof(U)) {
+            cfg::Node::Scalar v;
+            v.f = src[i];
+            if (!ScalarToFloat(cfg::eValueType_Float, v, &out[i]))
+                return i;
+        }
+        else
+            out[i] = (T)src[i];
+    }
+    return count;
+}
+
+template <typename T>
+size_t ExtractNumbers( cfg::Node *n, T *out, size_t max ) {
+    switch (n->value_type) {
+        case cfg::eValueType_Int32Array:
+            return CopyNumberArray((int32_t *)n->value.array.data, n->value.array.count, out, max);
+        case cfg::eValueType_FloatArray:
+            if constexpr (std::numeric_limits<T>::is_integer)
+                return 0; // Floats aren't integers, same as TryAs.
+            else
+                return CopyNumberArray((float *)n->value.array.data, n->value.array.count, out, max);
+        case cfg::eValueType_DoubleArray:
+            if constexpr (std::numeric_limits<T>::is_integer)
+                return 0;
+            else
+                return CopyNumberArray((double *)n->value.array.data, n->value.array.count, out, max);
+        default:
+            break;
+    }
+
+    if (n->first_child) {
+        size_t count = 0;
+        for (auto c = n->first_child; c && count < max; c = c->next) {
+            if (!c->TryAs(out[count]))
+                break;
+            ++count;
+        }
+        return count;
+    }
+
+    if (n->str)
+        return ParseNumberList(n->str, n->str + cfg::StringLength(n->str), out, max);
+    return 0;
+}
+
+size_t cfg::Node::ExtractFloats(float *out, size_t max) { return ExtractNumbers(this, out, max); }
+size_t cfg::Node::ExtractDoubles(double *out, size_t max) { return ExtractNumbers(this, out, max); }
+size_t cfg::Node::ExtractInt32(int32_t *out, size_t max) { return ExtractNumbers(this, out, max); }
+
+template <typename T>
+bool AttachNumbers( cfg::Node *n, cfg::Container *ctn, cfg::eValueType type ) {
+    size_t count = 0;
+    if (n->first_child)
+        count = n->ChildCount();
+    else if (n->str)
+        count = CountNumberList<T>(n->str, n->str + cfg::StringLength(n->str));
+
+    auto data = (T *)ctn->Allocate((count ? count : 1) * sizeof(T));
+    if (!data)
+        return false;
+    count = ExtractNumbers(n, data, count);
+
+    n->value_type = type;
+    n->value.array.data = data;
+    n->value.array.count = count;
+    return true;
+}
+
+bool cfg::Node::AttachNumberArray(Container *ctn, eValueType type) {
+    switch (type) {
+        case eValueType_Int32Array:  return AttachNumbers<int32_t>(this, ctn, type);
+        case eValueType_FloatArray:  return AttachNumbers<float>(this, ctn, type);
+        case eValueType_DoubleArray: return AttachNumbers<double>(this, ctn, type);
+        default: return false;
+    }
+}
+
+// Parses may run on several threads at once (eg: LiveConfig::ReloadFileAsync).
+thread_local cfg::Container *g_curr_container;
+std::atomic<unsigned int> g_generation_counter;
+
+// Records where a node came from in the source being parsed. Spans are 32-bit offsets, so documents of 4 GB or more go without.
+inline void StoreNodeSpan( cfg::Node *node, const char *begin, const char *end ) {
+    auto ctn = g_curr_container;
+    if (ctn->source_len > 0xFFFFFFFFu)
+        return;
+    node->src_begin = (unsigned int)(begin - ctn->source);
+    node->src_end = (unsigned int)(end - ctn->source);
+}
+
+/// ---- Path ---- ///
+bool cfg::Path::Compile(const char *path) {
+    segments = nullptr;
+    count = 0;
+    cached_owner = nullptr;
+    cached_generation = 0;
+    cached_node = nullptr;
+
+    if (!path || !*path)
+        return false;
+
+    // JSON Pointers start with a '/', everything else is dotted.
+    char sep = '.';
+    auto c = path;
+    if (*c == '/') {
+        sep = '/';
+        ++c;
+    }
+
+    size_t len = cfg::StringLength((char *)c);
+    unsigned int num = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (c[i] == sep)
+            ++num;
+    }
+
+    // Segments and their (unescaped) names share one allocation.
+    auto block = (char *)cfg::cbk::malloc((sizeof(Segment) * num) + len + num);
+    if (!block)
+        return false;
+    segments = (Segment *)block;
+    auto stack = block + (sizeof(Segment) * num);
+
+    for (unsigned int i = 0; i < num; ++i) {
+        auto seg = &segments[i];
+        seg->name = stack;
+
+        while (*c && *c != sep) {
+            // JSON Pointer escapes: '~0' is '~', '~1' is '/'.
+            if (sep == '/' && *c == '~' && (*(c + 1) == '0' || *(c + 1) == '1')) {
+                *stack = (*(c + 1) == '0') ? '~' : '/';
+                c += 2;
+            }
+            else {
+                *stack = *c;
+                ++c;
+            }
+            ++stack;
+        }
+        *stack = 0;
+        ++stack;
+        if (*c == sep)
+            ++c;
+
+        seg->len = (unsigned int)((stack - 1) - seg->name);
+        seg->hash = cfg::HashString(seg->name, seg->len);
+        seg->index = -1;
+
+        if (seg->len) {
+            int idx = 0;
+            unsigned int j = 0;
+            for (; j < seg->len && CFG_IS_NUMBER(seg->name[j]); ++j) {
+                int digit = seg->name[j] - '0';
+                if (idx > (std::numeric_limits<int>::max() - digit) / 10)
+                    break; // Too big for an index, it can only be a name.
+                idx = (idx * 10) + digit;
+            }
+            if (j == seg->len)
+                seg->index = idx;
+        }
+    }
+
+    count = num;
+    return true;
+}
+
+void cfg::Path::Release() {
+    cfg::cbk::free(segments);
+    segments = nullptr;
+    count = 0;
+    cached_owner = nullptr;
+    cached_node = nullptr;
+}
+
+// Exact match of a string against a known-length one. Unlike StringCompare this doesn't accept prefixes.
+bool MatchName( char *name, const char *str, unsigned int len ) {
+    if (!name)
+        return false;
+    for (unsigned int i = 0; i < len; ++i) {
+        if (name[i] != str[i])
+            return false;
+    }
+    return name[len] == 0;
+}
+
+
+cfg::Node *ResolveSegment( cfg::Node *first, cfg::Path::Segment *seg ) {
+    if (seg->index >= 0 && first && !first->name) {
+        auto n = first;
+        for (int i = seg->index; n && i; --i)
+            n = n->next;
+        return n;
+    }
+    return FindNode(first, seg->name, seg->len, seg->hash);
+}
+
+/// ---- Versions ---- ///
+// A versioned container never changes a published node. An edit copies the sibling lists on the way from the
+// top level down to the change into new contiguous arrays (so GetChild stays O(1)), changes the copy and
+// publishes a new root. Everything off that path is shared with the previous version, which stays valid.
+// The writer owns the container's heaps; readers only load the current version, with acquire ordering.
+struct cfg::VersionState {
+    std::atomic<cfg::Version *> current;
+};
+
+// One node on a resolved path, and whether it was found among its parent's attributes.
+struct PathStep {
+    cfg::Node *node;
+    bool attribute;
+};
+
+// Follows 'path' from the list at 'first'. Records the nodes on the way in 'steps' if given.
+cfg::Node *ResolvePathNodes( cfg::Node *first, cfg::Path &path, PathStep *steps ) {
+    if (!path.count)
+        return nullptr;
+
+    auto n = ResolveSegment(first, &path.segments[0]);
+    if (steps)
+        steps[0] = { n, false };
+
+    for (unsigned int i = 1; n && i < path.count; ++i) {
+        auto seg = &path.segments[i];
+        bool attribute = false;
+        if (seg->index >= 0 && n->first_child && !n->first_child->name)
+            n = n->GetChild((unsigned int)seg->index);
+        else {
+            // Children first, then attributes (INI keys, XML attributes).
+            auto r = FindNode(n->first_child, seg->name, seg->len, seg->hash);
+            if (!r) {
+                r = FindNode(n->first_attribute, seg->name, seg->len, seg->hash);
+                attribute = true;
+            }
+            n = r;
+        }
+        if (steps)
+            steps[i] = { n, attribute };
+    }
+    return n;
+}
+
+cfg::Node *FindTopNode( cfg::Node *first, const char *name, unsigned int len, unsigned int hash, unsigned int depth ) {
+    for (auto n = first; n; n = n->next) {
+        if (n->NameEquals(name, len, hash))
+            return n;
+        if (depth) {
+            auto r = FindChild(n->first_child, name, len, hash, depth);
+            if (r)
+                return r;
+        }
+    }
+    return nullptr;
+}
+
+// Copies a sibling list into one new array, leaving out 'skip' and adding 'spare' zeroed nodes at the end. The copies
+// share their children and attributes with the originals. '*target_copy' is set to the copy of 'target'.
+bool CopySiblings( cfg::Container *ctn, cfg::Node *first, cfg::Node *parent, cfg::Node *skip, unsigned int spare,
+                   cfg::Node *target, cfg::Node **target_copy, cfg::Node **copy, unsigned int *count ) {
+    unsigned int k = spare;
+    for (auto n = first; n; n = n->next)
+        k += (n != skip);
+
+    *copy = nullptr;
+    *count = k;
+    if (!k)
+        return true;
+
+    auto base = (cfg::Node *)ctn->Allocate(k * sizeof(cfg::Node));
+    if (!base)
+        return false;
+
+    unsigned int i = 0;
+    for (auto n = first; n; n = n->next) {
+        if (n == skip)
+            continue;
+        base[i] = *n;
+        if (n == target)
+            *target_copy = &base[i];
+        ++i;
+    }
+    for (i = 0; i < k; ++i) {
+        base[i].parent = parent;
+        base[i].next = (i + 1 < k) ? &base[i + 1] : nullptr;
+    }
+    *copy = base;
+    return true;
+}
+
+// Hangs a copied list off its new parent, or makes it the new top level.
+void AttachCopiedList( cfg::Node *parent, bool attributes, cfg::Node *list, unsigned int count, cfg::Node **top ) {
+    if (!parent)
+        *top = list;
+    else if (attributes)
+        parent->first_attribute = list;
+    else {
+        parent->first_child = list;
+        parent->child_count = count;
+        parent->last_child = count ? &list[count - 1] : nullptr;
+        parent->flags |= cfg::eNodeFlag_PackedChildren;
+    }
+}
+
+enum eVersionEdit {
+    eVersionEdit_SetString,
+    eVersionEdit_Append,
+    eVersionEdit_Remove,
+};
+
+cfg::Version *PublishVersionEdit( cfg::Container *ctn, cfg::Path &path, eVersionEdit edit, const char *name, const char *str ) {
+    if (!ctn->versions || (!path.count && edit != eVersionEdit_Append))
+        return nullptr;
+
+    auto current = ctn->versions->current.load(std::memory_order_relaxed); // Only this thread stores it.
+
+    PathStep local_steps[32];
+    auto steps = (path.count <= 32) ? local_steps : (PathStep *)cfg::cbk::malloc(path.count * sizeof(PathStep));
+    if (!steps)
+        return nullptr;
+
+    cfg::Version *version = nullptr;
+    cfg::Node *top = current->first;
+    cfg::Node *parent = nullptr;
+    unsigned int top_flags = 0;
+    bool ok = !path.count || ResolvePathNodes(current->first, path, steps);
+
+    // Down the path, copying each list and continuing from the copy of the node that was on it.
+    auto list = current->first;
+    for (unsigned int i = 0; ok && i < path.count; ++i) {
+        auto target = steps[i].node;
+        auto skip = (edit == eVersionEdit_Remove && i + 1 == path.count) ? target : nullptr;
+
+        cfg::Node *copy, *target_copy = nullptr;
+        unsigned int count;
+        ok = CopySiblings(ctn, list, parent, skip, 0, target, &target_copy, &copy, &count);
+        if (!ok)
+            break;
+        AttachCopiedList(parent, steps[i].attribute, copy, count, &top);
+
+        if (skip) {
+            if (parent)
+                parent->flags |= cfg::eNodeFlag_Restructured;
+            else
+                top_flags |= cfg::eNodeFlag_Restructured;
+            break;
+        }
+
+        target_copy->flags |= cfg::eNodeFlag_Dirty;
+        parent = target_copy;
+        if (i + 1 < path.count)
+            list = steps[i + 1].attribute ? target->first_attribute : target->first_child;
+    }
+
+    if (ok && edit == eVersionEdit_SetString) {
+        ok = StoreEditedString(ctn, parent, str);
+        if (ok)
+            parent->Classify();
+    }
+
+    if (ok && edit == eVersionEdit_Append) {
+        cfg::Node *copy, *unused;
+        unsigned int count;
+        ok = CopySiblings(ctn, parent ? parent->first_child : current->first, parent, nullptr, 1, nullptr, &unused, &copy, &count);
+        if (ok) {
+            auto node = &copy[count - 1];
+            ok = (!name || StoreEditedName(ctn, node, name)) && (!str || StoreEditedString(ctn, node, str));
+            node->flags |= cfg::eNodeFlag_Dirty;
+            node->Classify();
+            AttachCopiedList(parent, false, copy, count, &top);
+            if (parent)
+                parent->flags |= cfg::eNodeFlag_Restructured;
+            else
+                top_flags |= cfg::eNodeFlag_Restructured;
+        }
+    }
+
+    if (ok)
+        version = (cfg::Version *)ctn->Allocate(sizeof(cfg::Version));
+    if (version) {
+        version->first = top;
+        version->number = current->number + 1;
+        version->generation = ++g_generation_counter;
+        version->previous = current;
+
+        // The writer's own view follows the newest version.
+        ctn->first = top;
+        ctn->last = nullptr;
+        ctn->top_flags |= top_flags | cfg::eNodeFlag_Dirty;
+        ctn->generation = version->generation;
+        ctn->versions->current.store(version, std::memory_order_release);
+    }
+
+    if (steps != local_steps)
+        cfg::cbk::free(steps);
+    return version;
+}
+
+cfg::Node *cfg::Version::GetNode(char *name, unsigned int depth) {
+    auto len = (unsigned int)cfg::StringLength(name);
+    return FindTopNode(first, name, len, cfg::HashString(name, len), depth);
+}
+
+cfg::Node *cfg::Version::GetNode(Key key, unsigned int depth) {
+    return FindTopNode(first, key.name, key.len, key.hash, depth);
+}
+
+// Uncached, the same Path is used from every thread reading a version.
+cfg::Node *cfg::Version::Resolve(Path &path) {
+    return ResolvePathNodes(first, path, nullptr);
+}
+
+/// ---- XPath ---- ///
+const char *CompileXPathName( const char *c, char *&stack, char **name, unsigned int *len, unsigned int *hash ) {
+    *name = stack;
+    while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_' || *c == '-' || *c == '.' || *c == ':') {
+        *stack = *c;
+        ++stack;
+        ++c;
+    }
+    *len = (unsigned int)(stack - *name);
+    *hash = cfg::HashString(*name, *len);
+    *stack = 0;
+    ++stack;
+    return c;
+}
+
+bool cfg::XPath::Compile(const char *expr) {
+    steps = nullptr;
+    count = 0;
+
+    if (!expr || !*expr)
+        return false;
+
+    size_t len = cfg::StringLength((char *)expr);
+    unsigned int max_steps = 1;
+    unsigned int max_preds = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (expr[i] == '/') ++max_steps;
+        if (expr[i] == '[') ++max_preds;
+    }
+
+    auto block = (char *)cfg::cbk::malloc((sizeof(Step) * max_steps) + (sizeof(Predicate) * max_preds) + (len * 2) + 2);
+    if (!block)
+        return false;
+    steps = (Step *)block;
+    auto preds = (Predicate *)(block + (sizeof(Step) * max_steps));
+    auto stack = (char *)(preds + max_preds);
+
+    auto c = expr;
+    while (*c) {
+        auto step = &steps[count];
+        memset(step, 0, sizeof(Step));
+
+        // Axis. A leading step without a '/' is treated as absolute.
+        if (*c == '/') {
+            ++c;
+            if (*c == '/') {
+                step->descendant = true;
+                ++c;
+            }
+        }
+        else if (count != 0) {
+            goto fail;
+        }
+
+        if (*c == '@') {
+            step->attribute = true;
+            ++c;
+        }
+
+        if (*c == '*') {
+            step->wildcard = true;
+            ++c;
+        }
+        else {
+            c = CompileXPathName(c, stack, &step->name, &step->len, &step->hash);
+            if (step->len == 0)
+                goto fail;
+        }
+
+        step->predicates = preds;
+        while (*c == '[') {
+            if (step->predicate_count == CFG_XPATH_PREDICATES_MAX)
+                goto fail;
+
+            auto pred = &preds[step->predicate_count];
+            memset(pred, 0, sizeof(Predicate));
+            ++c;
+
+            if (CFG_IS_NUMBER(*c)) {
+                pred->kind = ePredicate_Position;
+                while (CFG_IS_NUMBER(*c)) {
+                    pred->position = (pred->position * 10) + (*c - '0');
+                    ++c;
+                }
+                if (pred->position == 0)
+                    goto fail;
+            }
+            else if (c[0] == 'l' && c[1] == 'a' && c[2] == 's' && c[3] == 't' && c[4] == '(' && c[5] == ')') {
+                pred->kind = ePredicate_Last;
+                c += 6;
+            }
+            else {
+                bool attribute = false;
+                if (*c == '@') {
+                    attribute = true;
+                    ++c;
+                }
+                c = CompileXPathName(c, stack, &pred->name, &pred->len, &pred->hash);
+                if (pred->len == 0)
+                    goto fail;
+
+                pred->kind = attribute ? ePredicate_HasAttribute : ePredicate_HasChild;
+                if (*c == '=') {
+                    pred->kind = attribute ? ePredicate_AttributeEquals : ePredicate_ChildEquals;
+                    ++c;
+
+                    char quote = *c;
+                    if (quote != '\'' && quote != '"')
+                        goto fail;
+                    ++c;
+
+                    pred->value = stack;
+                    while (*c && *c != quote) {
+                        *stack = *c;
+                        ++stack;
+                        ++c;
+                    }
+                    if (*c != quote)
+                        goto fail;
+                    ++c;
+                    pred->value_len = (unsigned int)(stack - pred->value);
+                    *stack = 0;
+                    ++stack;
+                }
+            }
+
+            if (*c != ']')
+                goto fail;
+            ++c;
+            ++step->predicate_count;
+        }
+        preds += step->predicate_count;
+        ++count;
+
+        // Attributes can't have children, so an attribute step must be the last one.
+        if (step->attribute && *c)
+            goto fail;
+        if (*c && *c != '/')
+            goto fail;
+    }
+
+    return true;
+
+fail:
+    Release();
+    return false;
+}
+
+void cfg::XPath::Release() {
+    cfg::cbk::free(steps);
+    steps = nullptr;
+    count = 0;
+}
+
+struct XPathQuery {
+    cfg::XPath *xpath;
+    cfg::Node **out;
+    size_t max;
+    size_t found;
+};
+
+bool MatchXPathStep( cfg::XPath::Step *step, cfg::Node *n ) {
+    if (step->wildcard)
+        return n->name != nullptr;
+    return n->NameEquals(step->name, step->len, step->hash);
+}
+
+bool MatchXPathPredicate( cfg::XPath::Predicate *pred, cfg::Node *n ) {
+    switch (pred->kind) {
+        case cfg::XPath::ePredicate_HasAttribute:
+        case cfg::XPath::ePredicate_AttributeEquals:
+            for (auto a = n->first_attribute; a; a = a->next) {
+                if (!a->NameEquals(pred->name, pred->len, pred->hash))
+                    continue;
+                return pred->kind == cfg::XPath::ePredicate_HasAttribute || MatchName(a->GetString(), pred->value, pred->value_len);
+            }
+            return false;
+
+        case cfg::XPath::ePredicate_HasChild:
+        case cfg::XPath::ePredicate_ChildEquals:
+            for (auto c = n->first_child; c; c = c->next) {
+                if (!c->NameEquals(pred->name, pred->len, pred->hash))
+                    continue;
+                if (pred->kind == cfg::XPath::ePredicate_HasChild || MatchName(c->GetString(), pred->value, pred->value_len))
+                    return true;
+            }
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+// Checks the predicates of 'step' in order, stopping at 'end'. Positional counters are per context node, and
+// nullptr skips [N]. 'last' holds the sibling each [last()] stands for (see BeginXPathList).
+bool MatchXPathPredicates( cfg::XPath::Step *step, cfg::Node *n, unsigned int end, unsigned int *positions, cfg::Node **last ) {
+    for (unsigned int p = 0; p < end; ++p) {
+        auto pred = &step->predicates[p];
+
+        if (pred->kind == cfg::XPath::ePredicate_Position) {
+            if (!positions)
+                continue;
+            if (++positions[p] != pred->position)
+                return false;
+        }
+        else if (pred->kind == cfg::XPath::ePredicate_Last) {
+            if (n != last[p])
+                return false;
+        }
+        else if (!MatchXPathPredicate(pred, n)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One step's view of a sibling list, so positions and last() cost one pass over the list rather than one per node.
+struct XPathListState {
+    unsigned int positions[CFG_XPATH_PREDICATES_MAX];
+    cfg::Node *last[CFG_XPATH_PREDICATES_MAX];
+    bool positional;    // The step has [N] or [last()], every sibling is checked in order to keep 'positions' right.
+    signed char matched; // For the current sibling: 1 passes the step, 0 doesn't, -1 not checked yet.
+};
+
+void BeginXPathList( cfg::XPath::Step *step, cfg::Node *first, XPathListState *state ) {
+    state->positional = false;
+    state->matched = -1;
+    for (unsigned int p = 0; p < step->predicate_count; ++p) {
+        state->positions[p] = 0;
+        if (step->predicates[p].kind == cfg::XPath::ePredicate_Position)
+            state->positional = true;
+        else if (step->predicates[p].kind == cfg::XPath::ePredicate_Last) {
+            // The last sibling that passes the step and the non-positional predicates before this one.
+            state->positional = true;
+            state->last[p] = nullptr;
+            for (auto s = first; s; s = s->next) {
+                if (MatchXPathStep(step, s) && MatchXPathPredicates(step, s, p, nullptr, state->last))
+                    state->last[p] = s;
+            }
+        }
+    }
+}
+
+// Moves 'state' on to sibling 'n'. Other steps are only checked when something asks (MatchXPathSibling).
+void NextXPathSibling( cfg::XPath::Step *step, cfg::Node *n, XPathListState *state ) {
+    state->matched = -1;
+    if (state->positional)
+        state->matched = MatchXPathStep(step, n) && MatchXPathPredicates(step, n, step->predicate_count, state->positions, state->last);
+}
+
+bool MatchXPathSibling( cfg::XPath::Step *step, cfg::Node *n, XPathListState *state ) {
+    if (state->matched < 0)
+        state->matched = MatchXPathStep(step, n) && MatchXPathPredicates(step, n, step->predicate_count, nullptr, state->last);
+    return state->matched != 0;
+}
+
+void EvaluateXPathStep( XPathQuery *q, unsigned int idx, cfg::Node *context, cfg::Node *children );
+
+// Applies child step 'idx' to one sibling list (the children or attributes of a single context node). Matches
+// are handled before moving to the next sibling, so results come out in document order.
+void EvaluateXPathList( XPathQuery *q, unsigned int idx, cfg::Node *first ) {
+    auto step = &q->xpath->steps[idx];
+    bool last_step = (idx + 1 == q->xpath->count);
+    XPathListState state;
+    BeginXPathList(step, first, &state);
+
+    for (auto n = first; n && q->found < q->max; n = n->next) {
+        NextXPathSibling(step, n, &state);
+        if (!MatchXPathSibling(step, n, &state))
+            continue;
+
+        if (last_step) {
+            q->out[q->found] = n;
+            ++q->found;
+        }
+        else {
+            EvaluateXPathStep(q, idx + 1, n, n->first_child);
+        }
+
+        // A satisfied leading positional predicate means no later sibling can match.
+        if (step->predicate_count && step->predicates[0].kind == cfg::XPath::ePredicate_Position)
+            break;
+    }
+}
+
+// A node on the way down from the context of the first '//' step. The context itself has no parent frame.
+// 'states' are the list 'node' is in, one per step from 'base' on, moved on to 'node'.
+struct XPathFrame {
+    cfg::Node *node;
+    XPathListState *states;
+    unsigned int base;
+    XPathFrame *parent;
+};
+
+// Checks steps 'first'..'idx' against 'frame' and its ancestors, from the bottom up. Step 'first' is the leading
+// '//' step, it matches anywhere below the context. Results are kept in the frames, so ancestors are checked once.
+bool MatchXPathUp( XPathQuery *q, unsigned int first, unsigned int idx, XPathFrame *frame ) {
+    auto step = &q->xpath->steps[idx];
+    if (!MatchXPathSibling(step, frame->node, &frame->states[idx - frame->base]))
+        return false;
+    if (idx == first)
+        return true;
+
+    if (!step->descendant)
+        return frame->parent->parent && MatchXPathUp(q, first, idx - 1, frame->parent);
+    for (auto f = frame->parent; f->parent; f = f->parent) {
+        if (MatchXPathUp(q, first, idx - 1, f))
+            return true;
+    }
+    return false;
+}
+
+// Visits the subtree below 'frame' in document order (attributes before children) and tests every node against the
+// whole remaining path. Each node is reached once, so a node found through several '//' steps is only reported once.
+void WalkXPath( XPathQuery *q, unsigned int first, XPathFrame *frame, cfg::Node *children ) {
+    auto steps = q->xpath->steps;
+    unsigned int last = q->xpath->count - 1;
+    auto node = frame->node;
+
+    if (steps[last].attribute && node) {
+        XPathListState state;
+        BeginXPathList(&steps[last], node->first_attribute, &state);
+        for (auto a = node->first_attribute; a && q->found < q->max; a = a->next) {
+            NextXPathSibling(&steps[last], a, &state);
+            XPathFrame attribute = { a, &state, last, frame };
+            if (MatchXPathUp(q, first, last, &attribute)) {
+                q->out[q->found] = a;
+                ++q->found;
+            }
+        }
+    }
+    if (!children)
+        return;
+
+    // One state per element step for this list (a trailing attribute step only sees attribute frames). Long paths
+    // are rare, they go to the heap.
+    unsigned int count = (steps[last].attribute ? last : last + 1) - first;
+    XPathListState local_states[4];
+    auto states = (count <= 4) ? local_states : (XPathListState *)cfg::cbk::malloc(count * sizeof(XPathListState));
+    if (!states)
+        return;
+    for (unsigned int i = 0; i < count; ++i)
+        BeginXPathList(&steps[first + i], children, &states[i]);
+
+    for (auto n = children; n && q->found < q->max; n = n->next) {
+        for (unsigned int i = 0; i < count; ++i)
+            NextXPathSibling(&steps[first + i], n, &states[i]);
+
+        XPathFrame child = { n, states, first, frame };
+        if (!steps[last].attribute && MatchXPathUp(q, first, last, &child)) {
+            q->out[q->found] = n;
+            ++q->found;
+        }
+        WalkXPath(q, first, &child, n->first_child);
+    }
+
+    if (states != local_states)
+        cfg::cbk::free(states);
+}
+
+// Applies step 'idx' to a context node. The document itself is a null context whose children are Container::first.
+// Child steps narrow the set of contexts directly; from the first '//' step on, the context's subtree is walked once.
+void EvaluateXPathStep( XPathQuery *q, unsigned int idx, cfg::Node *context, cfg::Node *children ) {
+    auto step = &q->xpath->steps[idx];
+
+    if (step->descendant) {
+        XPathFrame root = { context, nullptr, 0, nullptr };
+        WalkXPath(q, idx, &root, children);
+    }
+    else if (!step->attribute)
+        EvaluateXPathList(q, idx, children);
+    else if (context)
+        EvaluateXPathList(q, idx, context->first_attribute);
+}
+
+/// ---- Printing ---- ///
+// Printer output. Without a sink the buffer grows geometrically so the tree is only walked once. With one
+// it's flushed to the sink whenever it fills, so memory stays flat no matter how big the document is.
+struct PrintBuffer {
+    char *base = nullptr;
+    char *c = nullptr;
+    char *end = nullptr;
+    cfg::Sink *sink = nullptr;
+    bool  failed = false;
+    char  indent = '\t';
+    unsigned int indent_width = 1;
+
+    bool Grow( size_t n );
+    bool Flush( const char *extra = nullptr, size_t extra_len = 0 );
+    void WriteLarge( const char *str, size_t len );
+
+    // Makes room for 'n' more bytes.
+    inline bool Reserve( size_t n ) { return ((size_t)(end - c) >= n) || Grow(n); }
+    inline void Put( char ch ) { if (Reserve(1)) { *c = ch; ++c; } }
+    inline void Write( const char *str, size_t len ) {
+        if ((size_t)(end - c) >= len) {
+            memcpy(c, str, len);
+            c += len;
+        }
+        else
+            WriteLarge(str, len);
+    }
+    inline void Fill( char ch, size_t n ) { if (Reserve(n)) { memset(c, ch, n); c += n; } }
+    inline void Indent( int depth ) { Fill(indent, (size_t)depth * indent_width); }
+};
+
+bool PrintBuffer::Flush( const char *extra, size_t extra_len ) {
+    if (failed)
+        return false;
+
+    cfg::Sink::Chunk chunks[2] = { { base, (size_t)(c - base) }, { extra, extra_len } };
+    auto first = (chunks[0].len) ? chunks : chunks + 1;
+    unsigned int count = (unsigned int)((chunks + (extra_len ? 2 : 1)) - first);
+
+    if (count && !sink->write(sink->user, first, count)) {
+        failed = true;
+        return false;
+    }
+    c = base;
+    return true;
+}
+
+bool PrintBuffer::Grow( size_t n ) {
+    if (failed)
+        return false;
+
+    if (sink && base) {
+        if (!Flush())
+            return false;
+        if ((size_t)(end - c) >= n)
+            return true;
+    }
+
+    size_t used = c - base;
+    size_t size = (end - base) * 2;
+    if (size < 4096)
+        size = 4096;
+    if (size < used + n)
+        size = used + n;
+
+    auto r = (char *)cfg::cbk::realloc(base, size);
+    if (!r) {
+        failed = true;
+        return false;
+    }
+
+    base = r;
+    c = r + used;
+    end = r + size;
+    return true;
+}
+
+// Strings that don't fit. A sink gets them straight from the tree along with what's buffered.
+void PrintBuffer::WriteLarge( const char *str, size_t len ) {
+    if (sink && len >= (size_t)(end - base) / 2) {
+        Flush(str, len);
+        return;
+    }
+
+    if (Reserve(len)) {
+        memcpy(c, str, len);
+        c += len;
+    }
+}
+
+bool WriteFileChunks( void *user, const cfg::Sink::Chunk *chunks, unsigned int count ) {
+    int fd = (int)(intptr_t)user;
+
+#if defined(_WIN32)
+    for (unsigned int i = 0; i < count; ++i) {
+        auto data = chunks[i].data;
+        auto left = chunks[i].len;
+        while (left) {
+            int n = _write(fd, data, (unsigned int)((left > 0x40000000) ? 0x40000000 : left));
+            if (n <= 0)
+                return false;
+            data += n;
+            left -= n;
+        }
+    }
+    return true;
+#else
+    struct iovec iov[2];
+    unsigned int n = 0;
+    for (; n < count && n < 2; ++n) {
+        iov[n].iov_base = (void *)chunks[n].data;
+        iov[n].iov_len = chunks[n].len;
+    }
+
+    // writev can stop part way through, pick up where it left off.
+    auto v = iov;
+    while (n) {
+        ssize_t w = writev(fd, v, (int)n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        auto done = (size_t)w;
+        while (n && done >= v->iov_len) {
+            done -= v->iov_len;
+            ++v;
+            --n;
+        }
+        if (n) {
+            v->iov_base = (char *)v->iov_base + done;
+            v->iov_len -= done;
+        }
+    }
+    return true;
+#endif
+}
+
+cfg::Sink cfg::Sink::File( int fd ) {
+    return Sink{ WriteFileChunks, (void *)(intptr_t)fd };
+}
+
+inline bool IsJsonTree( cfg::eFileType type ) {
+    return type == cfg::eFileType_Json || type == cfg::eFileType_Cbor || type == cfg::eFileType_MsgPack;
+}
+
+// -- Incremental printing
+// Nodes that haven't changed since the parse are copied from the source as they were written. Runs of unchanged
+// siblings go out as one copy, unless the list was restructured (a removed node would still be in the source).
+inline bool IsCleanNode( cfg::Node *n ) {
+    return !(n->flags & cfg::eNodeFlag_Dirty) && n->src_end;
+}
+
+cfg::Node *CleanRunEnd( cfg::Node *n, bool restructured ) {
+    if (!restructured) {
+        while (n->next && IsCleanNode(n->next))
+            n = n->next;
+    }
+    return n;
+}
+
+inline void CopySourceSpan( cfg::Container *ctn, cfg::Node *first, cfg::Node *last, PrintBuffer &out ) {
+    out.Write(ctn->source + first->src_begin, last->src_end - first->src_begin);
+}
+
+// The first heap after the parse arena, for allocations made after parsing.
+void AllocGrowthHeap( cfg::Container *ctn ) {
+    ctn->base_heap.next = (cfg::Heap *)cfg::cbk::malloc(sizeof(cfg::Heap) + CFG_HEAP_SIZE);
+    ctn->heap = ctn->base_heap.next;
+    ctn->heap->base = (char *)(((uintptr_t)ctn->heap) + sizeof(cfg::Heap));
+    ctn->heap->ceiling = ctn->heap->base + CFG_HEAP_SIZE;
+    ctn->heap->free = ctn->heap->base;
+    ctn->heap->next = nullptr;
+    memset(ctn->heap->base, 0, CFG_HEAP_SIZE);
+}
+
+// ---- Forward for simplicity
+#if !defined(CFGPARSE_ALL)
+#if !defined(CFGPARSE_INI)
+bool ParseIni( cfg::Container *ctn, char *source, size_t len ) { return false; }
+void PrintIni( cfg::Container *ctn, PrintBuffer &out, bool compact ) {}
+void PrintIniIncremental( cfg::Container *ctn, PrintBuffer &out ) {}
+#endif // CFGPARSE_INI
+#if !defined(CFGPARSE_JSON)
+bool ParseJson( cfg::Container *ctn, char *source, size_t len ) { return false; }
+void PrintJson( cfg::Container *ctn, PrintBuffer &out, bool compact ) {}
+void PrintJsonIncremental( cfg::Container *ctn, PrintBuffer &out ) {}
+bool ParseCbor( cfg::Container *ctn, char *source, size_t len ) { return false; }
+bool ParseMsgPack( cfg::Container *ctn, char *source, size_t len ) { return false; }
+void PrintCbor( cfg::Container *ctn, PrintBuffer &out ) {}
+void PrintMsgPack( cfg::Container *ctn, PrintBuffer &out ) {}
+#endif // CFGPARSE_JSON
+#if !defined(CFGPARSE_XML)
+bool ParseXml( cfg::Container *ctn, char *source, size_t len ) { return false; }
+void PrintXml( cfg::Container *ctn, PrintBuffer &out, bool compact ) {}
+void PrintXmlIncremental( cfg::Container *ctn, PrintBuffer &out ) {}
+#endif // CFGPARSE_XML
+#if !defined(CFGPARSE_JSON)
+bool ParseYaml( cfg::Container *ctn, char *source, size_t len ) { return false; }
+void PrintYaml( cfg::Container *ctn, PrintBuffer &out, bool compact ) {}
+#endif // CFGPARSE_JSON
+#endif // CFGPARSE_ALL
+
+#if defined(CFGPARSE_INI) || defined(CFGPARSE_ALL)
+bool ParseIni(cfg::Container *ctn, char *source, size_t len) {
+	auto c = source;
+	auto tmp = c;
+
+	size_t total_size = 0;
+
+	// Measure strings.
+	while (*c) {
+		if (*c == '[') {
+			total_size += sizeof(cfg::Node);
+			
+			++c;
+			tmp = c;
+			while (*c != ']' && *c) ++ c;
+			total_size += (c - tmp) + 1;
+		}
+		else if (*c == '=') {
+			total_size += sizeof(cfg::Node);
+
+			--c;
+			while (*c == ' ') --c;
+			tmp = c + 1;
+			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_') --c;
+			++c;
+			total_size += (tmp - c) + 1;
+
+			while (*c != '=') ++c;
+			++c;
+			while (*c == ' ') ++c;
+			tmp = c;
+
+			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_' || *c == '-' || *c == '.') ++c;
+			total_size += (c - tmp) + 1;
+		}
+
+		if (!*c)
+			break;
+		++c;
+	}
+
+	if (total_size == 0)
+		return false;
+
+	// Allocate
+	ctn->base_heap.base = (char *)cfg::cbk::malloc(total_size);
+	memset(ctn->base_heap.base, 0, total_size);
+
+	ctn->base_heap.ceiling = ctn->base_heap.base + total_size;
+	ctn->base_heap.free = ctn->base_heap.base;
+	char *&stack = ctn->base_heap.free;
+
+	ctn->first = nullptr;
+
+	// Copy strings.
+	c = source;
+	tmp = c;
+    cfg::Node *active_section = nullptr;
+    cfg::Node *active_value = nullptr;
+
+	while (*c) {
+		if (*c == '[') {
+            auto section = (cfg::Node *)stack;
+			stack += sizeof(cfg::Node);
+
+			++c;
+			tmp = c;
+
+			while (*c != ']' && *c) ++c;
+			StoreNodeName(section, stack, tmp, (c - tmp));
+            StoreNodeSpan(section, tmp - 1, (*c) ? c + 1 : c);
+            active_value = nullptr;
+
+			if (!ctn->first)
+				ctn->first = section;
+			if (active_section)
+				active_section->next = section;
+			active_section = section;
+		}
+		else if (*c == '=') {
+			auto val = (cfg::Node *)stack;
+			stack += sizeof(cfg::Node);
+
+			--c;
+			while (*c == ' ') --c;
+			tmp = (c + 1);
+
+			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_') --c;
+			++c;
+
+			auto key_begin = c;
+			StoreNodeName(val, stack, c, (tmp - c));
+
+			while (*c != '=') ++c;
+			++c;
+			while (*c == ' ') ++c;
+
+			tmp = c;
+			while (CFG_IS_LETTER(*c) || CFG_IS_NUMBER(*c) || *c == '_' || *c == '-' || *c == '.') ++c;
+			memcpy(stack, tmp, (c - tmp));
+			val->str = stack;
+			stack += (c - tmp) + 1;
+
+            // A section's span runs to the end of its last key.
+            val->parent = active_section;
+            StoreNodeSpan(val, key_begin, c);
+            active_section->src_end = val->src_end;
+
+			if (!active_section->first_attribute)
+				active_section->first_attribute = val;
+			if (active_value)
+				active_value->next = val;
+			active_value = val;
+		}
+
+		if (!*c)
+			break;
+		++c;
+	}
+
+	// Setup heap for user-made allocations.
+	AllocGrowthHeap(ctn);
+
+    ctn->file_type = cfg::eFileType_Ini;
+    return true;
+}
+
+// A key without a string prints as 'key='.
+void PrintIniKey(cfg::Node *a, PrintBuffer &out) {
+    out.Write(a->name, a->name_len);
+    out.Put('=');
+    if (a->str)
+        out.Write(a->str, strlen(a->str));
+}
+
+void PrintIniSection(cfg::Node *s, PrintBuffer &out, bool compact) {
+    out.Put('[');
+    out.Write(s->name, s->name_len);
+    out.Write("]\n", 2);
+
+    for (auto a = s->first_attribute; a; a = a->next) {
+        PrintIniKey(a, out);
+        out.Put('\n');
+    }
+
+    // Blank line between sections.
+    if (!compact)
+        out.Put('\n');
+}
+
+void PrintIni(cfg::Container *ctn, PrintBuffer &out, bool compact) {
+    for (auto s = ctn->first; s; s = s->next)
+        PrintIniSection(s, out, compact);
+}
+
+void PrintIniIncremental(cfg::Container *ctn, PrintBuffer &out) {
+    bool restructured = (ctn->top_flags & cfg::eNodeFlag_Restructured) != 0;
+
+    for (auto s = ctn->first; s; s = s->next) {
+        if (IsCleanNode(s)) {
+            auto last = CleanRunEnd(s, restructured);
+            CopySourceSpan(ctn, s, last, out);
+            out.Write("\n\n", 2);
+            s = last;
+            continue;
+        }
+
+        out.Put('[');
+        out.Write(s->name, s->name_len);
+        out.Write("]\n", 2);
+
+        bool keys_restructured = (s->flags & cfg::eNodeFlag_Restructured) != 0;
+        for (auto a = s->first_attribute; a; a = a->next) {
+            if (IsCleanNode(a)) {
+                auto last = CleanRunEnd(a, keys_restructured);
+                CopySourceSpan(ctn, a, last, out);
+                a = last;
+            }
+            else
+                PrintIniKey(a, out);
+            out.Put('\n');
+        }
+        out.Put('\n');
+    }
+}
+#endif // CFGPARSE_INI
+
+#if defined(CFGPARSE_XML) || defined(CFGPARSE_ALL)
+cfg::Node *ParseXmlNode( char *&c, char *&stack, cfg::Node *parent, cfg::Container *ctn ) {
+    cfg::Node *node = (cfg::Node *)stack;
+    stack += sizeof( cfg::Node );
+    auto begin = c;
+
+    node->next = nullptr;
+    node->name = nullptr;
+    node->str = nullptr;
+    node->first_child = nullptr;
+    node->first_attribute = nullptr;
+
+    // Store name.
+    ++c;
+    auto tmp = c;
+    while (*c != ' ' && *c != '>' && *c != '/') ++c;
+    StoreNodeName(node, stack, tmp, (c - tmp));
+
+    // Store attributes.
+    cfg::Node *prev_attribute = nullptr;
+
+    while (*c != '>') {
+        if (*c == '=') {
+            cfg::Node *attrib = (cfg::Node *)stack;
+            stack += sizeof(cfg::Node);
+
+            --c;
+            while (*c == ' ') ++c;
+            tmp = (c + 1);
+            while (*c != ' ') --c;
+            ++c;
+
+            StoreNodeName(attrib, stack, c, (tmp - c));
+
+            while (*c != '"') ++c;
+            ++c;
+            tmp = c;
+            bool escaped = false;
+            while (*c != '"') {
+                escaped |= (*c == '&');
+                ++c;
+            }
+
+            memcpy(stack, tmp, (c - tmp));
+            attrib->str = stack;
+            stack += (c - tmp) + 1;
+            if (escaped)
+                attrib->flags |= cfg::eNodeFlag_XmlEscaped;
+            attrib->parent = node;
+
+            if (prev_attribute)
+                prev_attribute->next = attrib;
+            prev_attribute = attrib;
+            if (!node->first_attribute)
+                node->first_attribute = attrib;
+        }
+
+        ++c;
+    }
+
+    // If the node self-terminates, return.
+    if (*(c - 1) == '/') {
+        StoreNodeSpan(node, begin, c + 1);
+        while (*c && *c != '<') ++c;
+        return node;
+    }
+
+    // Look for the next *thing*.
+    ++c;
+    while (CFG_IS_WHITESPACE(*c)) {
+        ++c;
+    }
+
+    // If the next *thing* is some kind of text.
+    if (*c != '<') {
+        // Go to the end of the string
+        tmp = c;
+        bool escaped = false;
+        while (*c != '<') {
+            escaped |= (*c == '&');
+            ++c;
+        }
+        --c;
+        while (CFG_IS_WHITESPACE(*c)) --c;
+        ++c;
+
+        // Store.
+        memcpy(stack, tmp, (c - tmp));
+        node->str = stack;
+        stack += (c - tmp) + 1;
+        if (escaped)
+            node->flags |= cfg::eNodeFlag_XmlEscaped;
+
+        // Skip to the start of the next node.
+        while (*c && *c != '>') ++c;
+        StoreNodeSpan(node, begin, (*c) ? c + 1 : c);
+        while (*c && *c != '<') ++c;
+        return node;
+    }
+
+    // While the next node ISN'T a cap node...
+    cfg::Node *prev_node = nullptr;
+
+    while (*(c + 1) != '/') {
+        cfg::Node *current_child = ParseXmlNode(c, stack, node, ctn);
+        current_child->parent = node;
+        if (prev_node)
+            prev_node->next = current_child;
+        if (!node->first_child)
+            node->first_child = current_child;
+        prev_node = current_child;
+    }
+
+    while (*c && *c != '>') ++c;
+    StoreNodeSpan(node, begin, (*c) ? c + 1 : c);
+    while (*c != '<' && *c) ++c;
+    return node;
+}
+
+bool ParseXml( cfg::Container *ctn, char *source, size_t len ) {
+    auto c = source;
+    auto tmp = c;
+    size_t total_size = 0;
+
+    // Do measurements.
+    while (*c) {
+        switch (*c) {
+            case '<': 
+                {
+                    if (*(c + 1) == '/' || *(c + 1) == '?') {
+                        while (*c != '>') ++c;
+                        break;
+                    }
+
+                    total_size += sizeof(cfg::Node);
+
+                    ++c;
+                    tmp = c;
+                    while (*c != ' ' && *c != '>' && *c != '/') ++c;
+                    total_size += ((c - tmp) + 1);
+                    continue;
+                } break;
+
+            case '>':
+                {
+                    if (*(c - 1) == '/')
+                        break;
+                    
+                    ++c;
+
+                    while (*c != '<') {
+                        if (!CFG_IS_WHITESPACE(*c)) {
+                            tmp = c;
+                            while (*c != '<') ++c;
+                            --c;
+                            while (CFG_IS_WHITESPACE(*c)) --c;
+                            ++c;
+                            total_size += (c - tmp) + 1;
+                            continue;
+                        }
+                        ++c;
+                    }
+                    --c;
+                } break;
+
+            case '=':
+                {
+                    total_size += sizeof(cfg::Node);
+
+                    --c;
+                    while (*c == ' ') --c;
+                    tmp = c + 1;
+                    while (*c != ' ') --c;
+                    ++c;
+                    total_size += ((tmp - c) + 1);
+
+                    while (*c != '"') ++c;
+                    ++c;
+                    tmp = c;
+                    while (*c != '"') ++c;
+                    total_size += ((c - tmp) + 1);
+                } break;
+        }
+
+        ++c;
+    }
+
+    // Allocate.
+    ctn->base_heap.base = (char *)cfg::cbk::malloc(total_size);
+    memset(ctn->base_heap.base, 0, total_size);
+    ctn->base_heap.ceiling = (ctn->base_heap.base + total_size);
+    ctn->base_heap.free = ctn->base_heap.ceiling;
+
+    char *stack = ctn->base_heap.base;
+
+    // Iterate and store strings.
+    c = source;
+    tmp = c;
+
+    cfg::Node *prev = nullptr;
+    
+    while (*c) {
+        if (*c == '<') {
+            if (*(c + 1) == '?' || *(c + 1) == '/') {
+                while (*c != '>') ++c;
+                continue;
+            }
+
+            cfg::Node *node = ParseXmlNode(c, stack, prev, ctn);
+            if (!ctn->first)
+                ctn->first = node;
+            if (prev)
+                prev->next = node;
+            prev = node;
+
+            // ParseXmlNode leaves 'c' on the next '<' (or the terminator).
+            continue;
+        }
+
+        ++c;
+    }
+
+    // Allocate growth heap.
+    AllocGrowthHeap(ctn);
+
+    ctn->file_type = cfg::eFileType_Xml;
+    return true;
+}
+
+// Decoded strings that contain markup are escaped again, raw ones are copied back out as they were.
+// Nothing for a node without a string, so an attribute set to nullptr prints as a="".
+void PrintXmlString( cfg::Node *n, PrintBuffer &out ) {
+    if (!n->str)
+        return;
+    if (n->flags & cfg::eNodeFlag_NeedsEscape) {
+        if (out.Reserve(XmlEscapedLength(n->str)))
+            out.c = WriteXmlEscaped(out.c, n->str);
+    }
+    else
+        out.Write(n->str, strlen(n->str));
+}
+
+// The compact printers are separate instantiations, so they carry no layout checks at all.
+template <bool Compact>
+inline void PrintXmlCloseTag( cfg::Node *node, PrintBuffer &out ) {
+    out.Write("</", 2);
+    out.Write(node->name, node->name_len);
+    if constexpr (Compact)
+        out.Put('>');
+    else
+        out.Write(">\n", 2);
+}
+
+// '<name attr="..."', left open.
+void PrintXmlStartTag( cfg::Node *node, PrintBuffer &out ) {
+    out.Put('<');
+    out.Write(node->name, node->name_len);
+
+    for (auto a = node->first_attribute; a != nullptr; a = a->next) {
+        out.Put(' ');
+        out.Write(a->name, a->name_len);
+        out.Write("=\"", 2);
+        PrintXmlString(a, out);
+        out.Put('"');
+    }
+}
+
+template <bool Compact>
+void PrintXmlNode( cfg::Node *node, PrintBuffer &out, int depth ) {
+    if constexpr (!Compact)
+        out.Indent(depth);
+    PrintXmlStartTag(node, out);
+
+    if (!node->first_child && !node->str) {
+        if constexpr (Compact)
+            out.Write("/>", 2);
+        else
+            out.Write("/>\n", 3);
+        return;
+    }
+
+    out.Put('>');
+
+    if (node->str) {
+        PrintXmlString(node, out);
+        PrintXmlCloseTag<Compact>(node, out);
+        return;
+    }
+
+    if constexpr (!Compact)
+        out.Put('\n');
+
+    for (auto child = node->first_child; child != nullptr; child = child->next) {
+        PrintXmlNode<Compact>(child, out, depth + 1);
+    }
+
+    if constexpr (!Compact)
+        out.Indent(depth);
+    PrintXmlCloseTag<Compact>(node, out);
+}
+
+void PrintXml( cfg::Container *ctn, PrintBuffer &out, bool compact ) {
+    for (auto n = ctn->first; n != nullptr; n = n->next) {
+        if (compact)
+            PrintXmlNode<true>(n, out, 0);
+        else
+            PrintXmlNode<false>(n, out, 0);
+    }
+}
+
+void PrintXmlNodesIncremental( cfg::Container *ctn, cfg::Node *first, bool restructured, PrintBuffer &out, int depth ) {
+    for (auto n = first; n; n = n->next) {
+        out.Indent(depth);
+
+        if (IsCleanNode(n)) {
+            auto last = CleanRunEnd(n, restructured);
+            CopySourceSpan(ctn, n, last, out);
+            out.Put('\n');
+            n = last;
+            continue;
+        }
+
+        // Changed: a fresh start tag, then the same treatment for the children.
+        PrintXmlStartTag(n, out);
+        if (!n->first_child && !n->str) {
+            out.Write("/>\n", 3);
+            continue;
+        }
+
+        out.Put('>');
+        if (n->str) {
+            PrintXmlString(n, out);
+            PrintXmlCloseTag<false>(n, out);
+            continue;
+        }
+
+        out.Put('\n');
+        PrintXmlNodesIncremental(ctn, n->first_child, (n->flags & cfg::eNodeFlag_Restructured) != 0, out, depth + 1);
+        out.Indent(depth);
+        PrintXmlCloseTag<false>(n, out);
+    }
+}
+
+void PrintXmlIncremental( cfg::Container *ctn, PrintBuffer &out ) {
+    PrintXmlNodesIncremental(ctn, ctn->first, (ctn->top_flags & cfg::eNodeFlag_Restructured) != 0, out, 0);
+}
+#endif // CFGPARSE_XML
+
+#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
+#define CFG_JSON_NODE_SIZE (sizeof(cfg::Node) + 7) // Nodes are 8-byte aligned in the parse stack.
+#define CFG_IS_JSON_DELIMITER(c) (CFG_IS_WHITESPACE(c) || c == ',' || c == '}' || c == ']' || c == 0)
+
+cfg::Node *AllocJsonNode( char *&stack ) {
+    stack = (char *)(((uintptr_t)stack + 7) & ~(uintptr_t)7);
+    auto node = (cfg::Node *)stack;
+    stack += sizeof(cfg::Node);
+    return node;
+}
+
+template <typename T>
+bool ParseJsonNumber( const char *str, size_t len, T *out ) {
+    auto r = std::from_chars(str, str + len, *out);
+    return r.ec == std::errc() && r.ptr == str + len;
+}
+
+// Bare tokens are the literals or a number one of the value parsers accepts.
+bool IsJsonBareValue( const char *str, size_t len ) {
+    if (len == 4 && (memcmp(str, "true", 4) == 0 || memcmp(str, "null", 4) == 0))
+        return true;
+    if (len == 5 && memcmp(str, "false", 5) == 0)
+        return true;
+    cfg::Node::Scalar v;
+    return ParseJsonNumber(str, len, &v.i) || ParseJsonNumber(str, len, &v.u) || ParseJsonNumber(str, len, &v.f);
+}
+
+cfg::Node *ParseJsonObject( char *&c, char *&stack, const char *end, cfg::Node *parent );
+cfg::Node *ParseJsonArray( char *&c, char *&stack, const char *end, cfg::Node *parent );
+
+// Parses the value starting at 'c' into 'node' and leaves 'c' on the value's last character.
+// Bare numbers and literals are tagged (eNodeFlag_Bare) and decoded straight into the node's value;
+// the literals point at static strings rather than the parse stack.
+void ParseJsonValue( char *&c, char *&stack, const char *end, cfg::Node *node ) {
+    switch (*c) {
+        case '"': {
+            ++c;
+            auto tmp = c;
+            bool escaped = false;
+            c = ScanJsonString(c, end, &escaped);
+            memcpy(stack, tmp, (c - tmp));
+            node->str = stack;
+            stack += (c - tmp) + 1;
+            if (escaped)
+                node->flags |= cfg::eNodeFlag_JsonEscaped;
+        } break;
+
+        case '{':
+            node->first_child = ParseJsonObject(c, stack, end, node);
+            break;
+
+        case '[':
+            node->flags |= cfg::eNodeFlag_Array;
+            node->first_child = ParseJsonArray(c, stack, end, node);
+            break;
+
+        default: {
+            auto tmp = c;
+            while (!CFG_IS_JSON_DELIMITER(*c)) ++c;
+            size_t len = (c - tmp);
+            --c;
+
+            node->flags |= cfg::eNodeFlag_Bare;
+            if (len == 4 && memcmp(tmp, "true", 4) == 0) {
+                node->str = (char *)"true";
+                node->value_type = cfg::eValueType_Bool;
+                node->value.b = true;
+                break;
+            }
+            if (len == 5 && memcmp(tmp, "false", 5) == 0) {
+                node->str = (char *)"false";
+                node->value_type = cfg::eValueType_Bool;
+                node->value.b = false;
+                break;
+            }
+            if (len == 4 && memcmp(tmp, "null", 4) == 0) {
+                node->str = (char *)"null";
+                node->value_type = cfg::eValueType_Null;
+                break;
+            }
+
+            memcpy(stack, tmp, len);
+            node->str = stack;
+            stack += len + 1;
+
+            if (ParseJsonNumber(tmp, len, &node->value.i))
+                node->value_type = cfg::eValueType_Integer;
+            else if (ParseJsonNumber(tmp, len, &node->value.u))
+                node->value_type = cfg::eValueType_Unsigned;
+            else if (ParseJsonNumber(tmp, len, &node->value.f))
+                node->value_type = cfg::eValueType_Float;
+        } break;
+    }
+}
+
+// 'c' is on the '{'. Returns the first member and leaves 'c' on the '}'.
+cfg::Node *ParseJsonObject( char *&c, char *&stack, const char *end, cfg::Node *parent ) {
+    cfg::Node *first = nullptr;
+    cfg::Node *prev = nullptr;
+
+    ++c;
+    while (*c && *c != '}') {
+        if (*c != '"') {
+            ++c;
+            continue;
+        }
+
+        auto node = AllocJsonNode(stack);
+        node->parent = parent;
+        auto begin = c;
+
+        ++c;
+        auto tmp = c;
+        bool escaped = false;
+        c = ScanJsonString(c, end, &escaped);
+        StoreNodeName(node, stack, tmp, (c - tmp));
+
+        // Escaped keys are rare, so they're decoded right away to keep the name hash meaningful.
+        if (escaped) {
+            node->name_len = (unsigned int)DecodeJsonString(node->name, node->name, node->name_len);
+            node->name[node->name_len] = 0;
+            node->name_hash = cfg::HashString(node->name, node->name_len);
+            if (StringNeedsEscape(node->name))
+                node->flags |= cfg::eNodeFlag_NameEscape;
+        }
+
+        while (*c && *c != ':') ++c;
+        if (*c) ++c;
+        while (CFG_IS_WHITESPACE(*c)) ++c;
+        if (!*c)
+            break;
+
+        ParseJsonValue(c, stack, end, node);
+        if (*c) ++c;
+        StoreNodeSpan(node, begin, c);
+
+        if (prev)
+            prev->next = node;
+        prev = node;
+        if (!first)
+            first = node;
+    }
+    return first;
+}
+
+// 'c' is on the '['. Returns the first element and leaves 'c' on the ']'.
+cfg::Node *ParseJsonArray( char *&c, char *&stack, const char *end, cfg::Node *parent ) {
+    cfg::Node *first = nullptr;
+    cfg::Node *prev = nullptr;
+
+    ++c;
+    while (*c && *c != ']') {
+        if (CFG_IS_WHITESPACE(*c) || *c == ',') {
+            ++c;
+            continue;
+        }
+
+        auto node = AllocJsonNode(stack);
+        node->parent = parent;
+        auto begin = c;
+        ParseJsonValue(c, stack, end, node);
+        if (*c) ++c;
+        StoreNodeSpan(node, begin, c);
+
+        if (prev)
+            prev->next = node;
+        prev = node;
+        if (!first)
+            first = node;
+    }
+    return first;
+}
+
+bool ParseJson( cfg::Container *ctn, char *source, size_t len ) {
+    auto c = source;
+    auto tmp = c;
+    auto end = source + len;
+    size_t total = 0;
+    bool escaped = false;
+
+    // The first character MUST be a '{'.
+    while (CFG_IS_WHITESPACE(*c)) ++c;
+    if (*c != '{')
+        return false;
+
+    // Measure. Every string, container and bare value gets a node, which over-counts keys but never under-counts.
+    // This also checks the values before anything is allocated: bare tokens must be numbers or literals, and a
+    // value can't be missing ({"a":}, [1,,2]). 'last' is the previous '{', '[', ':' or ',', or 'v' after a value.
+    char last = 0;
+    while (*c) {
+        switch (*c) {
+            case '"': {
+                ++c;
+                tmp = c;
+                c = ScanJsonString(c, end, &escaped);
+                total += CFG_JSON_NODE_SIZE + CFG_SIZE(tmp, c);
+                last = 'v';
+            } break;
+
+            case '{':
+            case '[':
+                total += CFG_JSON_NODE_SIZE;
+                last = *c;
+                break;
+
+            case ',':
+            case ':':
+                if (last != 'v')
+                    return false;
+                last = *c;
+                break;
+
+            // A trailing ',' is let through.
+            case '}':
+            case ']':
+                if (last == ':')
+                    return false;
+                last = 'v';
+                break;
+
+            default:
+                if (CFG_IS_WHITESPACE(*c))
+                    break;
+                tmp = c;
+                while (!CFG_IS_JSON_DELIMITER(*c)) ++c;
+                if (!IsJsonBareValue(tmp, c - tmp))
+                    return false;
+                total += CFG_JSON_NODE_SIZE + CFG_SIZE(tmp, c);
+                last = 'v';
+                continue;
+        }
+
+        if (!*c)
+            break;
+        ++c;
+    }
+    if (last == ':')
+        return false;
+
+    // Allocate
+    ctn->base_heap.base = (char *)cfg::cbk::malloc(total);
+    memset(ctn->base_heap.base, 0, total);
+    ctn->base_heap.ceiling = (ctn->base_heap.base + total);
+    ctn->base_heap.free = ctn->base_heap.ceiling;
+    ctn->base_heap.next = nullptr;
+
+    c = source;
+    while (*c != '{') ++c;
+    char *stack = ctn->base_heap.base;
+
+    // The root object's members are the container's top level.
+    ctn->first = ParseJsonObject(c, stack, end, nullptr);
+
+    // Allocate subsequent heap.
+    AllocGrowthHeap(ctn);
+
+    ctn->file_type = cfg::eFileType_Json;
+    return true;
+}
+
+// Quoted, escaped if it was decoded and needs it.
+void PrintJsonString( const char *str, size_t len, bool escape, PrintBuffer &out ) {
+    out.Put('"');
+    if (!escape)
+        out.Write(str, len);
+    else if (out.Reserve(JsonEscapedLength(str)))
+        out.c = WriteJsonEscaped(out.c, str);
+    out.Put('"');
+}
+
+template <bool Compact>
+void PrintJsonNode( cfg::Node *n, PrintBuffer &out, int depth );
+
+template <bool Compact>
+void PrintJsonValue( cfg::Node *n, PrintBuffer &out, int depth );
+
+// Array elements from 'first' up to (not including) 'last'. Scalars stay on the '[' line, containers get their
+// own lines. Returns true if any did, in which case the ']' goes on its own line too.
+template <bool Compact>
+bool PrintJsonElements( cfg::Node *first, cfg::Node *last, PrintBuffer &out, int depth ) {
+    bool multiline = false;
+    for (auto e = first; e != last; e = e->next) {
+        if constexpr (!Compact) {
+            if (e->str)
+                out.Put(' ');
+            else {
+                multiline = true;
+                out.Put('\n');
+                out.Indent(depth + 1);
+            }
+        }
+
+        PrintJsonValue<Compact>(e, out, depth + 1);
+        if (e->next)
+            out.Put(',');
+    }
+    return multiline;
+}
+
+// Prints a node's value (no name, no trailing separator).
+template <bool Compact>
+void PrintJsonValue( cfg::Node *n, PrintBuffer &out, int depth ) {
+    if (n->str) {
+        if (n->flags & cfg::eNodeFlag_Bare)
+            out.Write(n->str, strlen(n->str));
+        else
+            PrintJsonString(n->str, strlen(n->str), (n->flags & cfg::eNodeFlag_NeedsEscape) != 0, out);
+        return;
+    }
+
+    if (IsJsonArray(n)) {
+        out.Put('[');
+        if (PrintJsonElements<Compact>(n->first_child, nullptr, out, depth)) {
+            out.Put('\n');
+            out.Indent(depth);
+        }
+        out.Put(']');
+        return;
+    }
+
+    out.Put('{');
+    if (!n->first_child) {
+        out.Put('}');
+        return;
+    }
+
+    if constexpr (!Compact)
+        out.Put('\n');
+    for (auto child = n->first_child; child; child = child->next)
+        PrintJsonNode<Compact>(child, out, depth + 1);
+
+    if constexpr (!Compact)
+        out.Indent(depth);
+    out.Put('}');
+}
+
+template <bool Compact>
+void PrintJsonNode( cfg::Node *n, PrintBuffer &out, int depth ) {
+    if constexpr (!Compact)
+        out.Indent(depth);
+
+    if (n->name) {
+        PrintJsonString(n->name, n->name_len, (n->flags & cfg::eNodeFlag_NameEscape) != 0, out);
+        if constexpr (Compact)
+            out.Put(':');
+        else
+            out.Write(" : ", 3);
+    }
+
+    PrintJsonValue<Compact>(n, out, depth);
+
+    if (n->next)
+        out.Put(',');
+    if constexpr (!Compact)
+        out.Put('\n');
+}
+
+template <bool Compact>
+void PrintJsonRoot( cfg::Container *ctn, PrintBuffer &out ) {
+    if constexpr (Compact)
+        out.Put('{');
+    else
+        out.Write("{\n", 2);
+
+    for (auto n = ctn->first; n; n = n->next)
+        PrintJsonNode<Compact>(n, out, 1);
+
+    out.Put('}');
+}
+
+void PrintJson( cfg::Container *ctn, PrintBuffer &out, bool compact ) {
+    if (compact)
+        PrintJsonRoot<true>(ctn, out);
+    else
+        PrintJsonRoot<false>(ctn, out);
+}
+
+void PrintJsonValueIncremental( cfg::Container *ctn, cfg::Node *n, PrintBuffer &out, int depth );
+
+void PrintJsonMembersIncremental( cfg::Container *ctn, cfg::Node *first, bool restructured, PrintBuffer &out, int depth ) {
+    for (auto n = first; n; n = n->next) {
+        out.Indent(depth);
+
+        if (IsCleanNode(n)) {
+            auto last = CleanRunEnd(n, restructured);
+            CopySourceSpan(ctn, n, last, out);
+            n = last;
+        }
+        else {
+            PrintJsonString(n->name, n->name_len, (n->flags & cfg::eNodeFlag_NameEscape) != 0, out);
+            out.Write(" : ", 3);
+            PrintJsonValueIncremental(ctn, n, out, depth);
+        }
+
+        if (n->next)
+            out.Put(',');
+        out.Put('\n');
+    }
+}
+
+void PrintJsonValueIncremental( cfg::Container *ctn, cfg::Node *n, PrintBuffer &out, int depth ) {
+    bool restructured = (n->flags & cfg::eNodeFlag_Restructured) != 0;
+
+    if (n->str) {
+        PrintJsonValue<false>(n, out, depth);
+        return;
+    }
+
+    if (IsJsonArray(n)) {
+        out.Put('[');
+
+        // Same layout as PrintJsonElements, a copied run counts as a container if any of it is one.
+        bool multiline = false;
+        for (auto e = n->first_child; e; e = e->next) {
+            auto last = IsCleanNode(e) ? CleanRunEnd(e, restructured) : e;
+
+            bool scalars = true;
+            for (auto r = e; ; r = r->next) {
+                scalars = scalars && r->str;
+                if (r == last)
+                    break;
+            }
+
+            if (scalars)
+                out.Put(' ');
+            else {
+                multiline = true;
+                out.Put('\n');
+                out.Indent(depth + 1);
+            }
+
+            if (IsCleanNode(e))
+                CopySourceSpan(ctn, e, last, out);
+            else
+                PrintJsonValueIncremental(ctn, e, out, depth + 1);
+
+            e = last;
+            if (e->next)
+                out.Put(',');
+        }
+
+        if (multiline) {
+            out.Put('\n');
+            out.Indent(depth);
+        }
+        out.Put(']');
+        return;
+    }
+
+    out.Put('{');
+    if (!n->first_child) {
+        out.Put('}');
+        return;
+    }
+
+    out.Put('\n');
+    PrintJsonMembersIncremental(ctn, n->first_child, restructured, out, depth + 1);
+    out.Indent(depth);
+    out.Put('}');
+}
+
+void PrintJsonIncremental( cfg::Container *ctn, PrintBuffer &out ) {
+    out.Write("{\n", 2);
+    PrintJsonMembersIncremental(ctn, ctn->first, (ctn->top_flags & cfg::eNodeFlag_Restructured) != 0, out, 1);
+    out.Put('}');
+}
+
+// -- CBOR and MessagePack
+// Both binary formats map onto the JSON tree: maps are objects, arrays are arrays and scalars are bare values
+// that come out classified. Strings are copied into the parse arena because names and strings must end in a 0,
+// byte strings are stored as unpadded base64url text (there's no place for raw bytes in a node).
+// Each format provides Read, which decodes one item's head, and the Put* functions used by the printer. Formats with
+// indefinite length strings set 'chunked_strings' and provide CopyChunks, which joins them.
+#define CFG_BINARY_DEPTH_MAX 1024
+
+enum eBinaryItem {
+    eBinaryItem_Integer,
+    eBinaryItem_Unsigned, // Only when it doesn't fit in int64_t.
+    eBinaryItem_Float,
+    eBinaryItem_Float32,  // Printed with float precision so it reads the same as it was written.
+    eBinaryItem_Bool,
+    eBinaryItem_Null,
+    eBinaryItem_Text,
+    eBinaryItem_Bytes,
+    eBinaryItem_Array,
+    eBinaryItem_Map,
+    eBinaryItem_Break,    // End of a CBOR indefinite length array or map.
+};
+
+struct BinaryItem {
+    eBinaryItem kind;
+    cfg::Node::Scalar value;
+    const char *data;     // Text and bytes.
+    size_t len;           // Bytes of text, elements of an array or pairs of a map.
+    bool chunked;         // Indefinite length, 'data' points at the first chunk (CBOR).
+    bool indefinite;      // Indefinite length array or map, ended by a break (CBOR).
+};
+
+// The build runs twice, once to measure the arena (stack is nullptr) and once to fill it.
+struct BinaryParse {
+    char *stack;
+    size_t total;
+    const char *end;
+    cfg::Node scratch;
+};
+
+inline uint64_t ReadBigEndian( const char *c, int bytes ) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v = (v << 8) | (unsigned char)c[i];
+    return v;
+}
+
+inline void PutBigEndian( PrintBuffer &out, uint64_t v, int bytes ) {
+    if (!out.Reserve(bytes))
+        return;
+    for (int i = bytes - 1; i >= 0; --i)
+        *out.c++ = (char)(v >> (i * 8));
+}
+
+inline double HalfToDouble( unsigned int h ) {
+    int exponent = (h >> 10) & 0x1F;
+    double mantissa = h & 0x3FF;
+    double v;
+    if (exponent == 0)
+        v = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        v = ldexp(mantissa + 1024, exponent - 25);
+    else
+        v = mantissa ? std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::infinity();
+    return (h & 0x8000) ? -v : v;
+}
+
+inline size_t Base64Length( size_t len ) {
+    return (len / 3) * 4 + ((len % 3) ? (len % 3) + 1 : 0);
+}
+
+char *WriteBase64( char *dst, const unsigned char *src, size_t len ) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *dst++ = digits[v >> 18];
+        *dst++ = digits[(v >> 12) & 63];
+        *dst++ = digits[(v >> 6) & 63];
+        *dst++ = digits[v & 63];
+    }
+    if (i < len) {
+        uint32_t v = (src[i] << 16) | ((i + 1 < len) ? (src[i + 1] << 8) : 0);
+        *dst++ = digits[v >> 18];
+        *dst++ = digits[(v >> 12) & 63];
+        if (i + 1 < len)
+            *dst++ = digits[(v >> 6) & 63];
+    }
+    return dst;
+}
+
+inline cfg::Node *AllocBinaryNode( BinaryParse &p ) {
+    if (!p.stack) {
+        p.total += CFG_JSON_NODE_SIZE;
+        return &p.scratch;
+    }
+    return AllocJsonNode(p.stack);
+}
+
+inline char *AllocBinaryText( BinaryParse &p, size_t len ) {
+    if (!p.stack) {
+        p.total += len + 1;
+        return nullptr;
+    }
+    auto text = p.stack;
+    text[len] = 0;
+    p.stack += len + 1;
+    return text;
+}
+
+// Text, bytes and numbers as a node's 'str' (or its name, for map keys). Returns the length, nullptr text while measuring.
+template <typename Format>
+char *StoreBinaryText( BinaryParse &p, const BinaryItem &item, size_t *len ) {
+    char *text;
+    switch (item.kind) {
+        case eBinaryItem_Text:
+            *len = item.len;
+            text = AllocBinaryText(p, item.len);
+            if (!text)
+                return nullptr;
+            if constexpr (Format::chunked_strings) {
+                if (item.chunked) {
+                    Format::CopyChunks(text, item.data);
+                    return text;
+                }
+            }
+            memcpy(text, item.data, item.len);
+            return text;
+
+        case eBinaryItem_Bytes:
+            *len = Base64Length(item.len);
+            text = AllocBinaryText(p, *len);
+            if (!text)
+                return nullptr;
+            if constexpr (Format::chunked_strings) {
+                if (item.chunked) {
+                    // Joined at the end of the text first, encoding forward never overtakes what it reads.
+                    auto bytes = text + *len - item.len;
+                    Format::CopyChunks(bytes, item.data);
+                    WriteBase64(text, (unsigned char *)bytes, item.len);
+                    return text;
+                }
+            }
+            WriteBase64(text, (const unsigned char *)item.data, item.len);
+            return text;
+
+        default: {
+            // Numbers, the longest shortest-form double is 24 characters.
+            text = AllocBinaryText(p, 31);
+            *len = 0;
+            if (!text)
+                return nullptr;
+
+            std::to_chars_result r;
+            if (item.kind == eBinaryItem_Integer)
+                r = std::to_chars(text, text + 31, item.value.i);
+            else if (item.kind == eBinaryItem_Unsigned)
+                r = std::to_chars(text, text + 31, item.value.u);
+            else if (item.kind == eBinaryItem_Float32)
+                r = std::to_chars(text, text + 31, (float)item.value.f);
+            else
+                r = std::to_chars(text, text + 31, item.value.f);
+            *r.ptr = 0;
+            *len = r.ptr - text;
+            p.stack = r.ptr + 1;
+            return text;
+        }
+    }
+}
+
+template <typename Format>
+bool ParseBinaryMembers( BinaryParse &p, const char *&c, const BinaryItem &head, cfg::Node *parent, cfg::Node **first, int depth );
+
+// Fills 'node' from an item whose head has been read, and reads the rest of it.
+template <typename Format>
+bool ParseBinaryValue( BinaryParse &p, const char *&c, const BinaryItem &item, cfg::Node *node, int depth ) {
+    switch (item.kind) {
+        case eBinaryItem_Array:
+            node->flags |= cfg::eNodeFlag_Array;
+            node->value_type = cfg::eValueType_None;
+            return ParseBinaryMembers<Format>(p, c, item, node, &node->first_child, depth + 1);
+
+        case eBinaryItem_Map:
+            node->value_type = cfg::eValueType_None;
+            return ParseBinaryMembers<Format>(p, c, item, node, &node->first_child, depth + 1);
+
+        case eBinaryItem_Bool:
+            node->flags |= cfg::eNodeFlag_Bare;
+            node->str = (char *)(item.value.b ? "true" : "false");
+            node->value_type = cfg::eValueType_Bool;
+            node->value.b = item.value.b;
+            return true;
+
+        case eBinaryItem_Text:
+        case eBinaryItem_Bytes: {
+            size_t len;
+            node->str = StoreBinaryText<Format>(p, item, &len);
+            node->value_type = cfg::eValueType_String;
+            if (node->str && StringNeedsEscape(node->str))
+                node->flags |= cfg::eNodeFlag_NeedsEscape;
+            return true;
+        }
+
+        case eBinaryItem_Break:
+            return false;
+
+        default:
+            break;
+    }
+
+    // JSON has no NaN or infinity, they're read as null.
+    node->flags |= cfg::eNodeFlag_Bare;
+    bool finite = (item.kind != eBinaryItem_Float && item.kind != eBinaryItem_Float32) || std::isfinite(item.value.f);
+    if (item.kind == eBinaryItem_Null || !finite) {
+        node->str = (char *)"null";
+        node->value_type = cfg::eValueType_Null;
+        return true;
+    }
+
+    size_t len;
+    node->str = StoreBinaryText<Format>(p, item, &len);
+    node->value = item.value;
+    node->value_type = (item.kind == eBinaryItem_Integer) ? cfg::eValueType_Integer
+                     : (item.kind == eBinaryItem_Unsigned) ? cfg::eValueType_Unsigned : cfg::eValueType_Float;
+    return true;
+}
+
+// The elements of an array, or the pairs of a map. Map keys must be text or integers.
+template <typename Format>
+bool ParseBinaryMembers( BinaryParse &p, const char *&c, const BinaryItem &head, cfg::Node *parent, cfg::Node **first, int depth ) {
+    if (depth > CFG_BINARY_DEPTH_MAX)
+        return false;
+
+    bool map = (head.kind == eBinaryItem_Map);
+    cfg::Node *prev = nullptr;
+    BinaryItem item;
+
+    for (size_t i = 0; head.indefinite || i < head.len; ++i) {
+        if (!Format::Read(c, p.end, item))
+            return false;
+        if (item.kind == eBinaryItem_Break) {
+            if (head.indefinite)
+                break;
+            return false;
+        }
+
+        auto node = AllocBinaryNode(p);
+        node->parent = parent;
+
+        if (map) {
+            if (item.kind != eBinaryItem_Text && item.kind != eBinaryItem_Integer && item.kind != eBinaryItem_Unsigned)
+                return false;
+
+            size_t len;
+            node->name = StoreBinaryText<Format>(p, item, &len);
+            if (node->name) {
+                node->name_len = (unsigned int)len;
+                node->name_hash = cfg::HashString(node->name, node->name_len);
+                if (StringNeedsEscape(node->name))
+                    node->flags |= cfg::eNodeFlag_NameEscape;
+            }
+
+            if (!Format::Read(c, p.end, item))
+                return false;
+        }
+
+        if (!ParseBinaryValue<Format>(p, c, item, node, depth))
+            return false;
+
+        if (p.stack) {
+            if (prev)
+                prev->next = node;
+            else
+                *first = node;
+            prev = node;
+        }
+    }
+    return true;
+}
+
+// The document must be a map, its pairs are the container's top level.
+template <typename Format>
+bool ParseBinary( cfg::Container *ctn, char *source, size_t len, cfg::eFileType type ) {
+    BinaryParse p = {};
+    p.end = source + len;
+
+    BinaryItem root;
+    const char *c = source;
+    if (!Format::Read(c, p.end, root) || root.kind != eBinaryItem_Map)
+        return false;
+    auto body = c;
+
+    // Measure, which also checks the whole document before anything is allocated.
+    cfg::Node *first = nullptr;
+    if (!ParseBinaryMembers<Format>(p, c, root, nullptr, &first, 0))
+        return false;
+
+    // Allocate
+    size_t total = p.total ? p.total : 1;
+    ctn->base_heap.base = (char *)cfg::cbk::malloc(total);
+    if (!ctn->base_heap.base)
+        return false;
+    memset(ctn->base_heap.base, 0, total);
+    ctn->base_heap.ceiling = (ctn->base_heap.base + total);
+    ctn->base_heap.free = ctn->base_heap.ceiling;
+    ctn->base_heap.next = nullptr;
+
+    p.stack = ctn->base_heap.base;
+    c = body;
+    ParseBinaryMembers<Format>(p, c, root, nullptr, &ctn->first, 0);
+
+    // Allocate subsequent heap.
+    AllocGrowthHeap(ctn);
+
+    ctn->file_type = type;
+    return true;
+}
+
+inline size_t CountBinaryMembers( cfg::Node *n ) {
+    if (n->flags & cfg::eNodeFlag_PackedChildren)
+        return n->child_count;
+    size_t count = 0;
+    for (auto c = n->first_child; c; c = c->next)
+        ++count;
+    return count;
+}
+
+// Only bare values trust their classification, a quoted "42" stays a string.
+template <typename Format>
+void PrintBinaryValue( cfg::Node *n, PrintBuffer &out ) {
+    if (n->str) {
+        if (n->flags & cfg::eNodeFlag_Bare) {
+            switch (n->value_type) {
+                case cfg::eValueType_Integer: Format::PutInteger(out, n->value.i); return;
+                case cfg::eValueType_Unsigned: Format::PutUnsigned(out, n->value.u); return;
+                case cfg::eValueType_Float: Format::PutFloat(out, n->value.f); return;
+                case cfg::eValueType_Bool: Format::PutBool(out, n->value.b); return;
+                case cfg::eValueType_Null: Format::PutNull(out); return;
+                default: break;
+            }
+        }
+
+        auto str = n->GetString();
+        Format::PutText(out, str, strlen(str));
+        return;
+    }
+
+    if (IsJsonArray(n)) {
+        Format::PutHead(out, eBinaryItem_Array, CountBinaryMembers(n));
+        for (auto e = n->first_child; e; e = e->next)
+            PrintBinaryValue<Format>(e, out);
+        return;
+    }
+
+    Format::PutHead(out, eBinaryItem_Map, CountBinaryMembers(n));
+    for (auto child = n->first_child; child; child = child->next) {
+        Format::PutText(out, child->name, child->name_len);
+        PrintBinaryValue<Format>(child, out);
+    }
+}
+
+template <typename Format>
+void PrintBinary( cfg::Container *ctn, PrintBuffer &out ) {
+    size_t count = 0;
+    for (auto n = ctn->first; n; n = n->next)
+        ++count;
+
+    Format::PutHead(out, eBinaryItem_Map, count);
+    for (auto n = ctn->first; n; n = n->next) {
+        Format::PutText(out, n->name, n->name_len);
+        PrintBinaryValue<Format>(n, out);
+    }
+}
+
+// RFC 8949. Tags are skipped, simple values other than false/true/null/undefined are rejected.
+struct CborFormat {
+    static constexpr bool chunked_strings = true;
+
+    // The argument that follows an initial byte, 'info' is its low 5 bits.
+    static bool ReadArgument( const char *&c, const char *end, unsigned int info, uint64_t *v ) {
+        if (info < 24) {
+            *v = info;
+            return true;
+        }
+        if (info > 27)
+            return false;
+        int bytes = 1 << (info - 24);
+        if (end - c < bytes)
+            return false;
+        *v = ReadBigEndian(c, bytes);
+        c += bytes;
+        return true;
+    }
+
+    static bool Read( const char *&c, const char *end, BinaryItem &item ) {
+        item.chunked = false;
+        item.indefinite = false;
+
+        while (c < end) {
+            unsigned int major = (unsigned char)*c >> 5;
+            unsigned int info = (unsigned char)*c & 0x1F;
+            ++c;
+
+            if (info == 31) {
+                switch (major) {
+                    case 2:
+                    case 3:
+                        return ReadChunks(c, end, major, item);
+                    case 4:
+                    case 5:
+                        item.kind = (major == 4) ? eBinaryItem_Array : eBinaryItem_Map;
+                        item.indefinite = true;
+                        item.len = 0;
+                        return true;
+                    case 7:
+                        item.kind = eBinaryItem_Break;
+                        return true;
+                }
+                return false;
+            }
+
+            uint64_t v;
+            if (major == 7) {
+                switch (info) {
+                    case 20:
+                    case 21:
+                        item.kind = eBinaryItem_Bool;
+                        item.value.b = (info == 21);
+                        return true;
+                    case 22:
+                    case 23:
+                        item.kind = eBinaryItem_Null;
+                        return true;
+                    case 25:
+                    case 26:
+                    case 27:
+                        if (!ReadArgument(c, end, info, &v))
+                            return false;
+                        if (info == 25)
+                            item.value.f = HalfToDouble((unsigned int)v);
+                        else if (info == 26) {
+                            uint32_t bits = (uint32_t)v;
+                            float f;
+                            memcpy(&f, &bits, 4);
+                            item.value.f = f;
+                        }
+                        else
+                            memcpy(&item.value.f, &v, 8);
+                        item.kind = (info == 27) ? eBinaryItem_Float : eBinaryItem_Float32;
+                        return true;
+                }
+                return false;
+            }
+
+            if (!ReadArgument(c, end, info, &v))
+                return false;
+
+            switch (major) {
+                case 0:
+                    item.kind = (v > (uint64_t)INT64_MAX) ? eBinaryItem_Unsigned : eBinaryItem_Integer;
+                    item.value.u = v;
+                    return true;
+                case 1:
+                    // -1 - v, which only doesn't fit in int64_t past -2^63.
+                    if (v > (uint64_t)INT64_MAX) {
+                        item.kind = eBinaryItem_Float;
+                        item.value.f = -1.0 - (double)v;
+                    }
+                    else {
+                        item.kind = eBinaryItem_Integer;
+                        item.value.i = -1 - (int64_t)v;
+                    }
+                    return true;
+                case 2:
+                case 3:
+                    if ((uint64_t)(end - c) < v)
+                        return false;
+                    item.kind = (major == 2) ? eBinaryItem_Bytes : eBinaryItem_Text;
+                    item.data = c;
+                    item.len = (size_t)v;
+                    c += v;
+                    return true;
+                case 4:
+                case 5:
+                    item.kind = (major == 4) ? eBinaryItem_Array : eBinaryItem_Map;
+                    item.len = (size_t)v;
+                    return true;
+                case 6:
+                    continue; // A tag, the item it tags follows.
+            }
+        }
+        return false;
+    }
+
+    // An indefinite length string is definite length chunks of the same type up to a break.
+    static bool ReadChunks( const char *&c, const char *end, unsigned int major, BinaryItem &item ) {
+        item.kind = (major == 2) ? eBinaryItem_Bytes : eBinaryItem_Text;
+        item.data = c;
+        item.len = 0;
+        item.chunked = true;
+
+        while (c < end) {
+            if ((unsigned char)*c == 0xFF) {
+                ++c;
+                return true;
+            }
+            if (((unsigned char)*c >> 5) != major)
+                return false;
+
+            uint64_t v;
+            unsigned int info = (unsigned char)*c & 0x1F;
+            ++c;
+            if (info == 31 || !ReadArgument(c, end, info, &v) || (uint64_t)(end - c) < v)
+                return false;
+            item.len += (size_t)v;
+            c += v;
+        }
+        return false;
+    }
+
+    static void CopyChunks( char *dst, const char *c ) {
+        while ((unsigned char)*c != 0xFF) {
+            uint64_t v;
+            unsigned int info = (unsigned char)*c & 0x1F;
+            ++c;
+            ReadArgument(c, c + 8, info, &v);
+            memcpy(dst, c, (size_t)v);
+            dst += v;
+            c += v;
+        }
+    }
+
+    static void PutArgument( PrintBuffer &out, unsigned int major, uint64_t v ) {
+        major <<= 5;
+        if (v < 24)
+            out.Put((char)(major | v));
+        else if (v <= 0xFF) {
+            out.Put((char)(major | 24));
+            PutBigEndian(out, v, 1);
+        }
+        else if (v <= 0xFFFF) {
+            out.Put((char)(major | 25));
+            PutBigEndian(out, v, 2);
+        }
+        else if (v <= 0xFFFFFFFF) {
+            out.Put((char)(major | 26));
+            PutBigEndian(out, v, 4);
+        }
+        else {
+            out.Put((char)(major | 27));
+            PutBigEndian(out, v, 8);
+        }
+    }
+
+    static void PutHead( PrintBuffer &out, eBinaryItem kind, size_t count ) { PutArgument(out, (kind == eBinaryItem_Array) ? 4 : 5, count); }
+    static void PutInteger( PrintBuffer &out, int64_t v ) { if (v < 0) PutArgument(out, 1, (uint64_t)(-1 - v)); else PutArgument(out, 0, (uint64_t)v); }
+    static void PutUnsigned( PrintBuffer &out, uint64_t v ) { PutArgument(out, 0, v); }
+    static void PutBool( PrintBuffer &out, bool v ) { out.Put(v ? (char)0xF5 : (char)0xF4); }
+    static void PutNull( PrintBuffer &out ) { out.Put((char)0xF6); }
+
+    static void PutText( PrintBuffer &out, const char *str, size_t len ) {
+        PutArgument(out, 3, len);
+        out.Write(str, len);
+    }
+
+    // Single precision when nothing is lost. ScalarToFloat refuses doubles a float can't hold.
+    static void PutFloat( PrintBuffer &out, double v ) {
+        cfg::Node::Scalar s;
+        float f;
+        s.f = v;
+        if (ScalarToFloat(cfg::eValueType_Float, s, &f) && (double)f == v) {
+            uint32_t bits;
+            memcpy(&bits, &f, 4);
+            out.Put((char)0xFA);
+            PutBigEndian(out, bits, 4);
+            return;
+        }
+        uint64_t bits;
+        memcpy(&bits, &v, 8);
+        out.Put((char)0xFB);
+        PutBigEndian(out, bits, 8);
+    }
+};
+
+// MessagePack. Extension types have no meaning here and are rejected.
+struct MsgPackFormat {
+    static constexpr bool chunked_strings = false;
+
+    static bool ReadBytes( const char *&c, const char *end, int bytes, uint64_t *v ) {
+        if (end - c < bytes)
+            return false;
+        *v = ReadBigEndian(c, bytes);
+        c += bytes;
+        return true;
+    }
+
+    static bool Read( const char *&c, const char *end, BinaryItem &item ) {
+        item.chunked = false;
+        item.indefinite = false;
+        if (c >= end)
+            return false;
+
+        unsigned int b = (unsigned char)*c++;
+        uint64_t v;
+
+        if (b <= 0x7F || b >= 0xE0) {
+            item.kind = eBinaryItem_Integer;
+            item.value.i = (int8_t)b;
+            return true;
+        }
+        if (b <= 0x8F || (b >= 0xDE && b <= 0xDF)) {
+            item.kind = eBinaryItem_Map;
+            if (b <= 0x8F)
+                v = b & 0x0F;
+            else if (!ReadBytes(c, end, (b == 0xDE) ? 2 : 4, &v))
+                return false;
+            item.len = (size_t)v;
+            return true;
+        }
+        if (b <= 0x9F || (b >= 0xDC && b <= 0xDD)) {
+            item.kind = eBinaryItem_Array;
+            if (b <= 0x9F)
+                v = b & 0x0F;
+            else if (!ReadBytes(c, end, (b == 0xDC) ? 2 : 4, &v))
+                return false;
+            item.len = (size_t)v;
+            return true;
+        }
+
+        switch (b) {
+            case 0xC0:
+                item.kind = eBinaryItem_Null;
+                return true;
+            case 0xC2:
+            case 0xC3:
+                item.kind = eBinaryItem_Bool;
+                item.value.b = (b == 0xC3);
+                return true;
+
+            case 0xC4: case 0xC5: case 0xC6: // bin 8/16/32
+            case 0xD9: case 0xDA: case 0xDB: // str 8/16/32
+                if (!ReadBytes(c, end, 1 << ((b - ((b >= 0xD9) ? 0xD9 : 0xC4))), &v) || (uint64_t)(end - c) < v)
+                    return false;
+                item.kind = (b >= 0xD9) ? eBinaryItem_Text : eBinaryItem_Bytes;
+                item.data = c;
+                item.len = (size_t)v;
+                c += v;
+                return true;
+
+            case 0xCA:
+            case 0xCB:
+                if (!ReadBytes(c, end, (b == 0xCA) ? 4 : 8, &v))
+                    return false;
+                if (b == 0xCA) {
+                    uint32_t bits = (uint32_t)v;
+                    float f;
+                    memcpy(&f, &bits, 4);
+                    item.value.f = f;
+                    item.kind = eBinaryItem_Float32;
+                }
+                else {
+                    memcpy(&item.value.f, &v, 8);
+                    item.kind = eBinaryItem_Float;
+                }
+                return true;
+
+            case 0xCC: case 0xCD: case 0xCE: case 0xCF: // uint 8/16/32/64
+                if (!ReadBytes(c, end, 1 << (b - 0xCC), &v))
+                    return false;
+                item.kind = (v > (uint64_t)INT64_MAX) ? eBinaryItem_Unsigned : eBinaryItem_Integer;
+                item.value.u = v;
+                return true;
+
+            case 0xD0: case 0xD1: case 0xD2: case 0xD3: { // int 8/16/32/64
+                int bytes = 1 << (b - 0xD0);
+                if (!ReadBytes(c, end, bytes, &v))
+                    return false;
+                int shift = 64 - bytes * 8;
+                item.kind = eBinaryItem_Integer;
+                item.value.i = (int64_t)(v << shift) >> shift;
+                return true;
+            }
+        }
+
+        if (b >= 0xA0 && b <= 0xBF) {
+            v = b & 0x1F;
+            if ((uint64_t)(end - c) < v)
+                return false;
+            item.kind = eBinaryItem_Text;
+            item.data = c;
+            item.len = (size_t)v;
+            c += v;
+            return true;
+        }
+        return false;
+    }
+
+    // The smallest of a fix form and the 16 or 32 bit lengths.
+    static void PutHead( PrintBuffer &out, eBinaryItem kind, size_t count ) {
+        bool array = (kind == eBinaryItem_Array);
+        if (count <= 15)
+            out.Put((char)((array ? 0x90 : 0x80) | count));
+        else if (count <= 0xFFFF) {
+            out.Put(array ? (char)0xDC : (char)0xDE);
+            PutBigEndian(out, count, 2);
+        }
+        else {
+            out.Put(array ? (char)0xDD : (char)0xDF);
+            PutBigEndian(out, count, 4);
+        }
+    }
+
+    static void PutUnsigned( PrintBuffer &out, uint64_t v ) {
+        if (v <= 0x7F)
+            out.Put((char)v);
+        else if (v <= 0xFF) {
+            out.Put((char)0xCC);
+            PutBigEndian(out, v, 1);
+        }
+        else if (v <= 0xFFFF) {
+            out.Put((char)0xCD);
+            PutBigEndian(out, v, 2);
+        }
+        else if (v <= 0xFFFFFFFF) {
+            out.Put((char)0xCE);
+            PutBigEndian(out, v, 4);
+        }
+        else {
+            out.Put((char)0xCF);
+            PutBigEndian(out, v, 8);
+        }
+    }
+
+    static void PutInteger( PrintBuffer &out, int64_t v ) {
+        if (v >= 0)
+            PutUnsigned(out, (uint64_t)v);
+        else if (v >= -32)
+            out.Put((char)v);
+        else if (v >= INT8_MIN) {
+            out.Put((char)0xD0);
+            PutBigEndian(out, (uint64_t)v, 1);
+        }
+        else if (v >= INT16_MIN) {
+            out.Put((char)0xD1);
+            PutBigEndian(out, (uint64_t)v, 2);
+        }
+        else if (v >= INT32_MIN) {
+            out.Put((char)0xD2);
+            PutBigEndian(out, (uint64_t)v, 4);
+        }
+        else {
+            out.Put((char)0xD3);
+            PutBigEndian(out, (uint64_t)v, 8);
+        }
+    }
+
+    static void PutBool( PrintBuffer &out, bool v ) { out.Put(v ? (char)0xC3 : (char)0xC2); }
+    static void PutNull( PrintBuffer &out ) { out.Put((char)0xC0); }
+
+    static void PutText( PrintBuffer &out, const char *str, size_t len ) {
+        if (len <= 31)
+            out.Put((char)(0xA0 | len));
+        else if (len <= 0xFF) {
+            out.Put((char)0xD9);
+            PutBigEndian(out, len, 1);
+        }
+        else if (len <= 0xFFFF) {
+            out.Put((char)0xDA);
+            PutBigEndian(out, len, 2);
+        }
+        else {
+            out.Put((char)0xDB);
+            PutBigEndian(out, len, 4);
+        }
+        out.Write(str, len);
+    }
+
+    static void PutFloat( PrintBuffer &out, double v ) {
+        cfg::Node::Scalar s;
+        float f;
+        s.f = v;
+        if (ScalarToFloat(cfg::eValueType_Float, s, &f) && (double)f == v) {
+            uint32_t bits;
+            memcpy(&bits, &f, 4);
+            out.Put((char)0xCA);
+            PutBigEndian(out, bits, 4);
+            return;
+        }
+        uint64_t bits;
+        memcpy(&bits, &v, 8);
+        out.Put((char)0xCB);
+        PutBigEndian(out, bits, 8);
+    }
+};
+
+bool ParseCbor( cfg::Container *ctn, char *source, size_t len ) { return ParseBinary<CborFormat>(ctn, source, len, cfg::eFileType_Cbor); }
+bool ParseMsgPack( cfg::Container *ctn, char *source, size_t len ) { return ParseBinary<MsgPackFormat>(ctn, source, len, cfg::eFileType_MsgPack); }
+void PrintCbor( cfg::Container *ctn, PrintBuffer &out ) { PrintBinary<CborFormat>(ctn, out); }
+void PrintMsgPack( cfg::Container *ctn, PrintBuffer &out ) { PrintBinary<MsgPackFormat>(ctn, out); }
+#endif // CFGPARSE_JSON
+
+#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
+bool ParseYaml( cfg::Container *ctn, char *source, size_t len ) {
+    return true;
+}
+
+void PrintYaml( cfg::Container *ctn, PrintBuffer &out, bool compact ) {
+}
+#endif // CFGPARSE_JSON
+
+/// ---- Parallel printing ---- ///
+// Large trees are cut into pieces of about the same estimated size, printed by a pool of threads into their own
+// buffers and joined in order. A piece is a run of siblings; a node too big for one piece is descended into, so
+// its opening and closing text become pieces of their own and its children are cut up the same way. That way a
+// document whose top level is a few huge members splits as well as one with many small ones.
+#if !defined(CFGPARSE_NO_THREADS)
+enum ePrintPiece {
+    ePrintPiece_Range, // Siblings 'first' up to 'last', printed by a worker.
+    ePrintPiece_Open,  // The text before the children of 'first', printed while joining.
+    ePrintPiece_Close, // The text after them.
+};
+
+struct PrintJob {
+    ePrintPiece kind;
+    cfg::Node *parent; // Holds the list, nullptr for the top level.
+    cfg::Node *first;
+    cfg::Node *last;   // Exclusive.
+    int depth;         // The depth the list's nodes are printed at.
+    PrintBuffer out;
+};
+
+struct PrintPlan {
+    cfg::Container *ctn;
+    bool compact;
+    size_t target;     // Estimated bytes per range.
+    char indent;
+    unsigned int indent_width;
+    PrintJob *jobs;
+    unsigned int count;
+    unsigned int capacity;
+    std::atomic<unsigned int> next; // The next job a worker takes.
+};
+
+// Parsed nodes know their size in the source. Built or copied ones (no span) are estimated from their strings.
+size_t EstimatePrintSize( cfg::Node *n ) {
+    if (n->src_end > n->src_begin)
+        return n->src_end - n->src_begin;
+
+    size_t size = 8 + n->name_len + (n->str ? strlen(n->str) : 0);
+    for (auto a = n->first_attribute; a; a = a->next)
+        size += 4 + a->name_len + (a->str ? strlen(a->str) : 0);
+    for (auto c = n->first_child; c; c = c->next)
+        size += EstimatePrintSize(c);
+    return size;
+}
+
+inline bool IsSplittable( cfg::eFileType type, cfg::Node *n ) {
+    return type != cfg::eFileType_Ini && !n->str && n->first_child;
+}
+
+bool AddPrintJob( PrintPlan &plan, ePrintPiece kind, cfg::Node *parent, cfg::Node *first, cfg::Node *last, int depth ) {
+    if (plan.count == plan.capacity) {
+        unsigned int capacity = plan.capacity ? plan.capacity * 2 : 64;
+        auto jobs = (PrintJob *)cfg::cbk::realloc(plan.jobs, capacity * sizeof(PrintJob));
+        if (!jobs)
+            return false;
+        plan.jobs = jobs;
+        plan.capacity = capacity;
+    }
+    auto job = new (&plan.jobs[plan.count]) PrintJob{ kind, parent, first, last, depth, PrintBuffer() };
+    job->out.indent = plan.indent;
+    job->out.indent_width = plan.indent_width;
+    ++plan.count;
+    return true;
+}
+
+// Cuts the list 'first' (the children of 'parent') into ranges of about plan.target bytes.
+bool SplitPrintList( PrintPlan &plan, cfg::Node *parent, cfg::Node *first, int depth ) {
+    auto type = plan.ctn->file_type;
+    auto range = first;
+    size_t range_size = 0;
+
+    for (auto n = first; n; n = n->next) {
+        size_t size = EstimatePrintSize(n);
+        if (size > plan.target && IsSplittable(type, n)) {
+            if (range != n && !AddPrintJob(plan, ePrintPiece_Range, parent, range, n, depth))
+                return false;
+            if (!AddPrintJob(plan, ePrintPiece_Open, parent, n, nullptr, depth) ||
+                !SplitPrintList(plan, n, n->first_child, depth + 1) ||
+                !AddPrintJob(plan, ePrintPiece_Close, parent, n, nullptr, depth))
+                return false;
+            range = n->next;
+            range_size = 0;
+            continue;
+        }
+
+        range_size += size;
+        if (range_size >= plan.target) {
+            if (!AddPrintJob(plan, ePrintPiece_Range, parent, range, n->next, depth))
+                return false;
+            range = n->next;
+            range_size = 0;
+        }
+    }
+
+    if (range && !AddPrintJob(plan, ePrintPiece_Range, parent, range, nullptr, depth))
+        return false;
+    return true;
+}
+
+// The same text the single threaded printers write around a node's children. JSON nodes hold their value at
+// 'depth' whether they're members or array elements, XML elements are at 'depth' and INI is never descended into.
+template <bool Compact>
+void PrintPieceOpen( cfg::eFileType type, const PrintJob &job, PrintBuffer &out ) {
+    switch (type) {
+#if defined(CFGPARSE_XML) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Xml:
+            if constexpr (!Compact)
+                out.Indent(job.depth);
+            PrintXmlStartTag(job.first, out);
+            out.Put('>');
+            if constexpr (!Compact)
+                out.Put('\n');
+            break;
+#endif
+#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Json: {
+            auto n = job.first;
+            if (job.parent && IsJsonArray(job.parent)) {
+                if constexpr (!Compact) {
+                    out.Put('\n');
+                    out.Indent(job.depth);
+                }
+            }
+            else {
+                if constexpr (!Compact)
+                    out.Indent(job.depth);
+                if (n->name) {
+                    PrintJsonString(n->name, n->name_len, (n->flags & cfg::eNodeFlag_NameEscape) != 0, out);
+                    if constexpr (Compact)
+                        out.Put(':');
+                    else
+                        out.Write(" : ", 3);
+                }
+            }
+
+            if (IsJsonArray(n))
+                out.Put('[');
+            else {
+                out.Put('{');
+                if constexpr (!Compact)
+                    out.Put('\n');
+            }
+        } break;
+#endif
+        default:
+            break;
+    }
+}
+
+template <bool Compact>
+void PrintPieceClose( cfg::eFileType type, const PrintJob &job, PrintBuffer &out ) {
+    switch (type) {
+#if defined(CFGPARSE_XML) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Xml:
+            if constexpr (!Compact)
+                out.Indent(job.depth);
+            PrintXmlCloseTag<Compact>(job.first, out);
+            break;
+#endif
+#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Json: {
+            auto n = job.first;
+            if (IsJsonArray(n)) {
+                // Same rule as PrintJsonElements, the ']' gets its own line if any element is a container.
+                bool multiline = false;
+                if constexpr (!Compact) {
+                    for (auto e = n->first_child; e && !multiline; e = e->next)
+                        multiline = !e->str;
+                }
+                if (multiline) {
+                    out.Put('\n');
+                    out.Indent(job.depth);
+                }
+                out.Put(']');
+            }
+            else {
+                if constexpr (!Compact)
+                    out.Indent(job.depth);
+                out.Put('}');
+            }
+
+            bool element = job.parent && IsJsonArray(job.parent);
+            if (n->next)
+                out.Put(',');
+            if constexpr (!Compact) {
+                if (!element)
+                    out.Put('\n');
+            }
+        } break;
+#endif
+        default:
+            break;
+    }
+}
+
+template <bool Compact>
+void PrintPieceRange( cfg::eFileType type, PrintJob &job ) {
+    auto &out = job.out;
+    switch (type) {
+#if defined(CFGPARSE_INI) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Ini:
+            for (auto n = job.first; n != job.last; n = n->next)
+                PrintIniSection(n, out, Compact);
+            break;
+#endif
+#if defined(CFGPARSE_XML) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Xml:
+            for (auto n = job.first; n != job.last; n = n->next)
+                PrintXmlNode<Compact>(n, out, job.depth);
+            break;
+#endif
+#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
+        case cfg::eFileType_Json:
+            if (job.parent && IsJsonArray(job.parent)) {
+                PrintJsonElements<Compact>(job.first, job.last, out, job.depth - 1);
+                break;
+            }
+            for (auto n = job.first; n != job.last; n = n->next)
+                PrintJsonNode<Compact>(n, out, job.depth);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+// Workers (and the calling thread) take ranges until none are left.
+void RunPrintJobs( PrintPlan *plan ) {
+    for (;;) {
+        unsigned int i = plan->next.fetch_add(1);
+        if (i >= plan->count)
+            return;
+
+        auto &job = plan->jobs[i];
+        if (job.kind != ePrintPiece_Range || !job.out.Grow(0))
+            continue;
+        if (plan->compact)
+            PrintPieceRange<true>(plan->ctn->file_type, job);
+        else
+            PrintPieceRange<false>(plan->ctn->file_type, job);
+    }
+}
+
+template <bool Compact>
+void JoinPrintPieces( PrintPlan &plan, PrintBuffer &out ) {
+    auto type = plan.ctn->file_type;
+    if (type == cfg::eFileType_Json) {
+        out.Put('{');
+        if constexpr (!Compact)
+            out.Put('\n');
+    }
+
+    for (unsigned int i = 0; i < plan.count; ++i) {
+        auto &job = plan.jobs[i];
+        if (job.kind == ePrintPiece_Open)
+            PrintPieceOpen<Compact>(type, job, out);
+        else if (job.kind == ePrintPiece_Close)
+            PrintPieceClose<Compact>(type, job, out);
+        else if (job.out.failed || !job.out.base)
+            out.failed = true;
+        else
+            out.Write(job.out.base, job.out.c - job.out.base);
+        cfg::cbk::free(job.out.base);
+    }
+
+    if (type == cfg::eFileType_Json)
+        out.Put('}');
+}
+
+// Returns false without printing anything if the tree isn't worth splitting, the caller prints it normally.
+// Sinks are always printed on one thread: every piece is a whole buffer, which would undo their flat memory use.
+bool PrintParallel( cfg::Container *ctn, PrintBuffer &out, const cfg::PrintOptions &options ) {
+    if (out.sink)
+        return false;
+    if (ctn->file_type != cfg::eFileType_Ini && ctn->file_type != cfg::eFileType_Xml && ctn->file_type != cfg::eFileType_Json)
+        return false;
+
+    unsigned int threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (threads > CFG_PRINT_THREADS_MAX)
+        threads = CFG_PRINT_THREADS_MAX;
+
+    // Every thread needs at least CFG_PRINT_SPLIT_MIN bytes of output to be worth starting.
+    size_t total = 0;
+    for (auto n = ctn->first; n; n = n->next)
+        total += EstimatePrintSize(n);
+    if (total / CFG_PRINT_SPLIT_MIN < threads)
+        threads = (unsigned int)(total / CFG_PRINT_SPLIT_MIN);
+    if (threads < 2)
+        return false;
+
+    // A few ranges per thread, so one slow range doesn't hold the others up.
+    PrintPlan plan;
+    plan.ctn = ctn;
+    plan.compact = options.compact;
+    plan.target = total / (threads * 4);
+    plan.indent = out.indent;
+    plan.indent_width = out.indent_width;
+    plan.jobs = nullptr;
+    plan.count = 0;
+    plan.capacity = 0;
+    plan.next = 0;
+    if (!SplitPrintList(plan, nullptr, ctn->first, (ctn->file_type == cfg::eFileType_Json) ? 1 : 0)) {
+        cfg::cbk::free(plan.jobs);
+        return false;
+    }
+
+    // Threads that can't be started leave their share to the others.
+    std::thread workers[CFG_PRINT_THREADS_MAX];
+    for (unsigned int i = 1; i < threads; ++i) {
+        try {
+            workers[i] = std::thread(RunPrintJobs, &plan);
+        }
+        catch (...) {
+            break;
+        }
+    }
+    RunPrintJobs(&plan);
+    for (unsigned int i = 1; i < threads; ++i) {
+        if (workers[i].joinable())
+            workers[i].join();
+    }
+
+    if (options.compact)
+        JoinPrintPieces<true>(plan, out);
+    else
+        JoinPrintPieces<false>(plan, out);
+    cfg::cbk::free(plan.jobs);
+    return true;
+}
+#else
+bool PrintParallel( cfg::Container *ctn, PrintBuffer &out, const cfg::PrintOptions &options ) { return false; }
+#endif // CFGPARSE_NO_THREADS
+
+/// ---- Conversion ---- ///
+// Printing a tree in a format other than the one it was parsed from, straight from the nodes. The mapping is
+// described in rules.txt. Text is decoded from the source format first and escaped for the target.
+
+inline bool IsNullNode( cfg::Node *n ) {
+    return (n->flags & cfg::eNodeFlag_Bare) && n->str && strcmp(n->str, "null") == 0;
+}
+
+template <bool Compact>
+inline void ConvertNewline( PrintBuffer &out, int depth ) {
+    if constexpr (!Compact) {
+        out.Put('\n');
+        out.Indent(depth);
+    }
+}
+
+// 'str' is NUL terminated, 'len' is its length.
+void ConvertJsonEscaped( const char *str, size_t len, PrintBuffer &out ) {
+    size_t escaped = JsonEscapedLength(str);
+    if (escaped == len)
+        out.Write(str, len);
+    else if (out.Reserve(escaped))
+        out.c = WriteJsonEscaped(out.c, str);
+}
+
+void ConvertJsonText( const char *str, PrintBuffer &out ) {
+    out.Put('"');
+    ConvertJsonEscaped(str, strlen(str), out);
+    out.Put('"');
+}
+
+// JSON's number grammar, stricter than what Classify accepts ('+1', '007', '.5' and 'inf' are numbers there).
+bool IsJsonNumberText( const char *c ) {
+    if (*c == '-')
+        ++c;
+    if (*c == '0')
+        ++c;
+    else if (CFG_IS_NUMBER(*c))
+        while (CFG_IS_NUMBER(*c)) ++c;
+    else
+        return false;
+
+    if (*c == '.') {
+        ++c;
+        if (!CFG_IS_NUMBER(*c))
+            return false;
+        while (CFG_IS_NUMBER(*c)) ++c;
+    }
+    if (*c == 'e' || *c == 'E') {
+        ++c;
+        if (*c == '+' || *c == '-')
+            ++c;
+        if (!CFG_IS_NUMBER(*c))
+            return false;
+        while (CFG_IS_NUMBER(*c)) ++c;
+    }
+    return *c == 0;
+}
+
+// Numbers and booleans are printed bare, everything else as a string.
+void ConvertJsonScalar( cfg::Node *n, PrintBuffer &out ) {
+    const char *str = n->GetString();
+    if (!str)
+        str = "";
+
+    auto type = n->Type();
+    bool number = (type == cfg::eValueType_Integer || type == cfg::eValueType_Unsigned || type == cfg::eValueType_Float);
+    if (type == cfg::eValueType_Bool || (number && IsJsonNumberText(str)))
+        out.Write(str, strlen(str));
+    else
+        ConvertJsonText(str, out);
+}
+
+void ConvertXmlText( const char *str, PrintBuffer &out ) {
+    size_t len = strlen(str);
+    size_t escaped = XmlEscapedLength(str);
+
+    if (escaped == len)
+        out.Write(str, len);
+    else if (out.Reserve(escaped))
+        out.c = WriteXmlEscaped(out.c, str);
+}
+
+// Links siblings that share a name, so repeated elements can be printed as one JSON array. 'next[i]' is the
+// index of the next sibling named like child i (or ~0u), 'follower[i]' is set on all but the first of a name.
+struct SiblingGroups {
+    cfg::Node   **nodes;
+    unsigned int *next;
+    bool         *follower;
+    unsigned int  count;
+
+    cfg::Node   *small_nodes[32];
+    unsigned int small_next[32];
+    bool         small_follower[32];
+    unsigned int small_table[64];
+    void        *block;
+
+    bool Build( cfg::Node *first );
+    void Release() { cfg::cbk::free(block); }
+};
+
+bool SiblingGroups::Build( cfg::Node *first ) {
+    count = 0;
+    block = nullptr;
+    for (auto n = first; n; n = n->next)
+        ++count;
+
+    unsigned int bits = 1;
+    while ((1u << bits) < count * 2)
+        ++bits;
+    unsigned int table_size = 1u << bits;
+
+    unsigned int *table;
+    if (count <= 32) {
+        nodes = small_nodes;
+        next = small_next;
+        follower = small_follower;
+        table = small_table;
+    }
+    else {
+        block = cfg::cbk::malloc(count * (sizeof(cfg::Node *) + sizeof(unsigned int) + sizeof(bool)) + table_size * sizeof(unsigned int));
+        if (!block)
+            return false;
+        nodes = (cfg::Node **)block;
+        next = (unsigned int *)(nodes + count);
+        table = next + count;
+        follower = (bool *)(table + table_size);
+    }
+    memset(table, 0xFF, table_size * sizeof(unsigned int));
+
+    // Each table slot holds the latest sibling seen with that name.
+    unsigned int i = 0;
+    for (auto n = first; n; n = n->next, ++i) {
+        nodes[i] = n;
+        next[i] = ~0u;
+        follower[i] = false;
+        if (!n->name)
+            continue;
+
+        unsigned int slot = (n->name_hash * 2654435761u) >> (32 - bits);
+        while (table[slot] != ~0u) {
+            auto prev = nodes[table[slot]];
+            if (n->NameEquals(prev->name, prev->name_len, prev->name_hash)) {
+                next[table[slot]] = i;
+                follower[i] = true;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+        table[slot] = i;
+    }
+    return true;
+}
+
+// -- To JSON
+template <bool Compact>
+bool ConvertJsonValue( cfg::Node *n, const char *prefix, PrintBuffer &out, int depth );
+
+template <bool Compact>
+inline void ConvertJsonKey( const char *prefix, const char *name, size_t len, bool &first, PrintBuffer &out, int depth ) {
+    if (!first)
+        out.Put(',');
+    first = false;
+
+    ConvertNewline<Compact>(out, depth);
+    out.Put('"');
+    out.Write(prefix, strlen(prefix));
+    ConvertJsonEscaped(name, len, out);
+    if constexpr (Compact)
+        out.Write("\":", 2);
+    else
+        out.Write("\" : ", 4);
+}
+
+// Members of an object: attributes, the node's own text and then its children, repeated names as arrays.
+template <bool Compact>
+bool ConvertJsonMembers( cfg::Node *attributes, const char *text, cfg::Node *children, const char *prefix, PrintBuffer &out, int depth ) {
+    bool first = true;
+    out.Put('{');
+
+    for (auto a = attributes; a; a = a->next) {
+        ConvertJsonKey<Compact>(prefix, a->name, a->name_len, first, out, depth + 1);
+        ConvertJsonScalar(a, out);
+    }
+
+    if (text) {
+        ConvertJsonKey<Compact>("", "#text", 5, first, out, depth + 1);
+        ConvertJsonText(text, out);
+    }
+
+    if (children) {
+        SiblingGroups groups;
+        if (!groups.Build(children)) {
+            out.failed = true;
+            return false;
+        }
+
+        for (unsigned int i = 0; i < groups.count; ++i) {
+            if (groups.follower[i])
+                continue;
+
+            auto n = groups.nodes[i];
+            ConvertJsonKey<Compact>("", n->name, n->name_len, first, out, depth + 1);
+            if (groups.next[i] == ~0u) {
+                if (!ConvertJsonValue<Compact>(n, prefix, out, depth + 1))
+                    break;
+                continue;
+            }
+
+            out.Put('[');
+            for (auto j = i; j != ~0u; j = groups.next[j]) {
+                if (j != i)
+                    out.Put(',');
+                ConvertNewline<Compact>(out, depth + 2);
+                if (!ConvertJsonValue<Compact>(groups.nodes[j], prefix, out, depth + 2))
+                    break;
+            }
+            ConvertNewline<Compact>(out, depth + 1);
+            out.Put(']');
+        }
+        groups.Release();
     }
 
-    return total;
+    if (!first)
+        ConvertNewline<Compact>(out, depth);
+    out.Put('}');
+    return !out.failed;
 }
-#endif // CFGPARSE_INI
-
-#if defined(CFGPARSE_XML) || defined(CFGPARSE_ALL)
-cfg::Node *ParseXmlNode( char *&c, char *&stack, cfg::Node *parent, cfg::Container *ctn ) {
-    cfg::Node *node = (cfg::Node *)stack;
-    stack += sizeof( cfg::Node );
 
-    node->next = nullptr;
-    node->name = nullptr;
-    node->str = nullptr;
-    node->first_child = nullptr;
-    node->first_attribute = nullptr;
+template <bool Compact>
+bool ConvertJsonValue( cfg::Node *n, const char *prefix, PrintBuffer &out, int depth ) {
+    if (n->first_attribute || n->first_child)
+        return ConvertJsonMembers<Compact>(n->first_attribute, n->GetString(), n->first_child, prefix, out, depth);
 
-    // Store name.
-    ++c;
-    auto tmp = c;
-    while (*c != ' ' && *c != '>' && *c != '/') ++c;
-    memcpy(stack, tmp, (c - tmp));
-    node->name = stack;
-    stack += (c - tmp) + 1;
+    if (n->GetString())
+        ConvertJsonScalar(n, out);
+    else
+        out.Write("null", 4);
+    return true;
+}
 
-    // Store attributes.
-    cfg::Node *prev_attribute = nullptr;
+template <bool Compact>
+void ConvertToJson( cfg::Container *ctn, PrintBuffer &out ) {
+    // Only XML attributes need telling apart, INI keys are stored as attributes too.
+    const char *prefix = (ctn->file_type == cfg::eFileType_Xml) ? "@" : "";
 
-    while (*c != '>') {
-        if (*c == '=') {
-            cfg::Node *attrib = (cfg::Node *)stack;
-            stack += sizeof(cfg::Node);
+    if (ctn->file_type != cfg::eFileType_Ini) {
+        ConvertJsonMembers<Compact>(nullptr, nullptr, ctn->first, prefix, out, 0);
+        return;
+    }
 
-            --c;
-            while (*c == ' ') ++c;
-            tmp = (c + 1);
-            while (*c != ' ') --c;
-            ++c;
+    // Sections are objects even when they're empty.
+    bool first = true;
+    out.Put('{');
+    for (auto s = ctn->first; s; s = s->next) {
+        ConvertJsonKey<Compact>("", s->name, s->name_len, first, out, 1);
+        ConvertJsonMembers<Compact>(s->first_attribute, nullptr, nullptr, prefix, out, 1);
+    }
+    if (!first)
+        ConvertNewline<Compact>(out, 0);
+    out.Put('}');
+}
 
-            memcpy(stack, c, (tmp - c));
-            attrib->name = stack;
-            stack += (tmp - c) + 1;
+// -- To XML
+inline bool IsXmlAttributeNode( cfg::Node *n ) {
+    return n->name && n->name[0] == '@' && n->name_len > 1 && n->str;
+}
 
-            while (*c != '"') ++c;
-            ++c;
-            tmp = c;
-            while (*c != '"') ++c;
+inline bool IsXmlTextNode( cfg::Node *n ) {
+    return n->name && n->name_len == 5 && memcmp(n->name, "#text", 5) == 0 && n->str;
+}
 
-            memcpy(stack, tmp, (c - tmp));
-            attrib->str = stack;
-            stack += (c - tmp) + 1;
+template <bool Compact>
+void ConvertXmlElement( const char *name, size_t len, cfg::Node *n, PrintBuffer &out, int depth );
 
-            if (prev_attribute)
-                prev_attribute->next = attrib;
-            prev_attribute = attrib;
-            if (!node->first_attribute)
-                node->first_attribute = attrib;
+// Arrays repeat their parent's element, nested arrays are wrapped and their elements called 'item'.
+template <bool Compact>
+void ConvertXmlArray( const char *name, size_t len, cfg::Node *n, PrintBuffer &out, int depth ) {
+    for (auto e = n->first_child; e; e = e->next) {
+        if (!IsJsonArray(e)) {
+            ConvertXmlElement<Compact>(name, len, e, out, depth);
+            continue;
         }
 
-        ++c;
+        if constexpr (!Compact)
+            out.Indent(depth);
+        out.Put('<');
+        out.Write(name, len);
+        out.Put('>');
+        if constexpr (!Compact)
+            out.Put('\n');
+
+        ConvertXmlArray<Compact>("item", 4, e, out, depth + 1);
+
+        if constexpr (!Compact)
+            out.Indent(depth);
+        out.Write("</", 2);
+        out.Write(name, len);
+        out.Put('>');
+        if constexpr (!Compact)
+            out.Put('\n');
     }
+}
 
-    // If the node self-terminates, return.
-    if (*(c - 1) == '/') {
-        while (*c != '<') ++c;
-        return node;
+template <bool Compact>
+void ConvertXmlElement( const char *name, size_t len, cfg::Node *n, PrintBuffer &out, int depth ) {
+    if (IsJsonArray(n)) {
+        ConvertXmlArray<Compact>(name, len, n, out, depth);
+        return;
     }
 
-    // Look for the next *thing*.
-    ++c;
-    while (CFG_IS_WHITESPACE(*c)) {
-        ++c;
+    if constexpr (!Compact)
+        out.Indent(depth);
+    out.Put('<');
+    out.Write(name, len);
+
+    // Attributes (INI keys, or '@' members), then find out what goes inside.
+    for (auto a = n->first_attribute; a; a = a->next) {
+        out.Put(' ');
+        out.Write(a->name, a->name_len);
+        out.Write("=\"", 2);
+        ConvertXmlText(a->GetString() ? a->str : "", out);
+        out.Put('"');
     }
 
-    // If the next *thing* is some kind of text.
-    if (*c != '<') {
-        // Go to the end of the string
-        tmp = c;
-        while (*c != '<') ++c;
-        --c;
-        while (CFG_IS_WHITESPACE(*c)) --c;
-        ++c;
+    const char *text = (IsNullNode(n)) ? nullptr : n->GetString();
+    bool elements = false;
+    for (auto c = n->first_child; c; c = c->next) {
+        if (IsXmlAttributeNode(c)) {
+            out.Put(' ');
+            out.Write(c->name + 1, c->name_len - 1);
+            out.Write("=\"", 2);
+            ConvertXmlText(c->GetString(), out);
+            out.Put('"');
+        }
+        else if (IsXmlTextNode(c))
+            text = c->GetString();
+        else
+            elements = true;
+    }
 
-        // Store.
-        memcpy(stack, tmp, (c - tmp));
-        node->str = stack;
-        stack += (c - tmp) + 1;
+    if (!text && !elements) {
+        if constexpr (Compact)
+            out.Write("/>", 2);
+        else
+            out.Write("/>\n", 3);
+        return;
+    }
 
-        // Skip to the start of the next node.
-        while (*c != '>') ++c;
-        while (*c != '<') ++c;
-        return node;
+    out.Put('>');
+    if (text)
+        ConvertXmlText(text, out);
+
+    if (elements) {
+        if constexpr (!Compact)
+            out.Put('\n');
+        for (auto c = n->first_child; c; c = c->next) {
+            if (!IsXmlAttributeNode(c) && !IsXmlTextNode(c))
+                ConvertXmlElement<Compact>(c->name ? c->name : "item", c->name ? c->name_len : 4, c, out, depth + 1);
+        }
+        if constexpr (!Compact)
+            out.Indent(depth);
     }
 
-    // While the next node ISN'T a cap node...
-    cfg::Node *prev_node = nullptr;
+    out.Write("</", 2);
+    out.Write(name, len);
+    out.Put('>');
+    if constexpr (!Compact)
+        out.Put('\n');
+}
 
-    while (*(c + 1) != '/') {
-        cfg::Node *current_child = ParseXmlNode(c, stack, node, ctn);
-        if (prev_node)
-            prev_node->next = current_child;
-        if (!node->first_child)
-            node->first_child = current_child;
-        prev_node = current_child;
+template <bool Compact>
+void ConvertToXml( cfg::Container *ctn, PrintBuffer &out ) {
+    for (auto n = ctn->first; n; n = n->next)
+        ConvertXmlElement<Compact>(n->name ? n->name : "item", n->name ? n->name_len : 4, n, out, 0);
+}
+
+// -- To INI
+// Nested names are joined with '.', built from the parents on the way down.
+struct IniKeyPath {
+    const char *name;
+    size_t len;
+    const IniKeyPath *parent;
+};
+
+// INI has no escapes. Names and values are written as-is, except that line breaks become spaces so a string
+// can't start a new key or section.
+void ConvertIniText( const char *str, size_t len, PrintBuffer &out ) {
+    auto end = str + len;
+    for (auto c = str; c != end; ++c) {
+        if (*c != '\n' && *c != '\r')
+            continue;
+        out.Write(str, c - str);
+        out.Put(' ');
+        str = c + 1;
     }
+    out.Write(str, end - str);
+}
 
-    while (*c != '>') ++c;
-    while (*c != '<' && *c) ++c;
-    return node;
+void PrintIniKeyPath( const IniKeyPath *path, PrintBuffer &out ) {
+    if (path->parent) {
+        PrintIniKeyPath(path->parent, out);
+        out.Put('.');
+    }
+    ConvertIniText(path->name, path->len, out);
 }
 
-bool ParseXml( cfg::Container *ctn, char *source, size_t len ) {
-    auto c = source;
-    auto tmp = c;
-    size_t total_size = 0;
+void ConvertIniKeys( cfg::Node *n, const IniKeyPath *path, PrintBuffer &out ) {
+    if (path && n->GetString() && !IsNullNode(n)) {
+        PrintIniKeyPath(path, out);
+        out.Put('=');
+        ConvertIniText(n->str, strlen(n->str), out);
+        out.Put('\n');
+    }
 
-    // Do measurements.
-    while (*c) {
-        switch (*c) {
-            case '<': 
-                {
-                    if (*(c + 1) == '/' || *(c + 1) == '?') {
-                        while (*c != '>') ++c;
-                        break;
-                    }
+    for (auto a = n->first_attribute; a; a = a->next) {
+        IniKeyPath sub = { a->name, a->name_len, path };
+        ConvertIniKeys(a, &sub, out);
+    }
 
-                    total_size += sizeof(cfg::Node);
+    // Unnamed children are array elements, which repeat their parent's key.
+    for (auto c = n->first_child; c; c = c->next) {
+        if (!c->name) {
+            ConvertIniKeys(c, path, out);
+            continue;
+        }
+        IniKeyPath sub = { c->name, c->name_len, path };
+        ConvertIniKeys(c, &sub, out);
+    }
+}
 
-                    ++c;
-                    tmp = c;
-                    while (*c != ' ' && *c != '>' && *c != '/') ++c;
-                    total_size += ((c - tmp) + 1);
-                    continue;
-                } break;
+inline bool IsIniSection( cfg::Node *n ) {
+    return !n->str && !IsJsonArray(n) && (n->first_attribute || n->first_child);
+}
 
-            case '>':
-                {
-                    if (*(c - 1) == '/')
-                        break;
-                    
-                    ++c;
+void ConvertToIni( cfg::Container *ctn, PrintBuffer &out, bool compact ) {
+    // Keys that don't belong to a section have to come before the first one.
+    for (auto n = ctn->first; n; n = n->next) {
+        if (!n->name || IsIniSection(n))
+            continue;
+        IniKeyPath path = { n->name, n->name_len, nullptr };
+        ConvertIniKeys(n, &path, out);
+    }
 
-                    while (*c != '<') {
-                        if (!CFG_IS_WHITESPACE(*c)) {
-                            tmp = c;
-                            while (*c != '<') ++c;
-                            --c;
-                            while (CFG_IS_WHITESPACE(*c)) --c;
-                            ++c;
-                            total_size += (c - tmp) + 1;
-                            continue;
-                        }
-                        ++c;
-                    }
-                    --c;
-                } break;
+    for (auto n = ctn->first; n; n = n->next) {
+        if (!n->name || !IsIniSection(n))
+            continue;
 
-            case '=':
-                {
-                    total_size += sizeof(cfg::Node);
+        if (!compact && out.c != out.base)
+            out.Put('\n');
+        out.Put('[');
+        ConvertIniText(n->name, n->name_len, out);
+        out.Write("]\n", 2);
+        ConvertIniKeys(n, nullptr, out);
+    }
+}
 
-                    --c;
-                    while (*c == ' ') --c;
-                    tmp = c + 1;
-                    while (*c != ' ') --c;
-                    ++c;
-                    total_size += ((tmp - c) + 1);
+bool ConvertContainer( cfg::Container *ctn, PrintBuffer &out, cfg::eFileType target, bool compact ) {
+    switch (target) {
+        case cfg::eFileType_Ini:
+            ConvertToIni(ctn, out, compact);
+            return true;
+        case cfg::eFileType_Xml:
+            if (compact)
+                ConvertToXml<true>(ctn, out);
+            else
+                ConvertToXml<false>(ctn, out);
+            return true;
+        case cfg::eFileType_Json:
+            if (compact)
+                ConvertToJson<true>(ctn, out);
+            else
+                ConvertToJson<false>(ctn, out);
+            return true;
+        default:
+            return false;
+    }
+}
 
-                    while (*c != '"') ++c;
-                    ++c;
-                    tmp = c;
-                    while (*c != '"') ++c;
-                    total_size += ((c - tmp) + 1);
-                } break;
-        }
+/// ---- Snapshots ---- ///
+// A snapshot is the finalized tree written out as one image: header, nodes (every sibling list contiguous, as
+// after Finalize), then strings and attached arrays. Links are stored as addresses for the image's preferred
+// base. Mapped at that base it's used as-is. Anywhere else every link is moved by the difference once.
+#define CFG_SNAPSHOT_MAGIC "CFGSNAP"
+#define CFG_SNAPSHOT_VERSION 1
+#define CFG_SNAPSHOT_ENDIAN 0x01020304u
+
+struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t node_size;  // sizeof(cfg::Node), which also pins the pointer size.
+    uint32_t file_type;
+    uint64_t base;       // Address the links were written for.
+    uint64_t size;       // Whole image, header included.
+    uint64_t nodes;      // Offset of the node array.
+    uint64_t node_count;
+};
+
+size_t SnapshotArrayBytes( cfg::Node *n ) {
+    switch (n->value_type) {
+        case cfg::eValueType_Int32Array: return n->value.array.count * sizeof(int32_t);
+        case cfg::eValueType_FloatArray: return n->value.array.count * sizeof(float);
+        case cfg::eValueType_DoubleArray: return n->value.array.count * sizeof(double);
+        default: return 0;
+    }
+}
 
-        ++c;
+void MeasureSnapshot( cfg::Node *first, size_t *nodes, size_t *bytes ) {
+    for (auto n = first; n; n = n->next) {
+        *nodes += 1;
+        if (n->name)
+            *bytes += n->name_len + 1;
+        if (n->str)
+            *bytes += strlen(n->str) + 1;
+        *bytes += (SnapshotArrayBytes(n) + 7) & ~(size_t)7;
+        MeasureSnapshot(n->first_attribute, nodes, bytes);
+        MeasureSnapshot(n->first_child, nodes, bytes);
     }
+}
 
-    // Allocate.
-    ctn->base_heap.base = (char *)cfg::cbk::malloc(total_size);
-    memset(ctn->base_heap.base, 0, total_size);
-    ctn->base_heap.ceiling = (ctn->base_heap.base + total_size);
-    ctn->base_heap.free = ctn->base_heap.ceiling;
+char *CopySnapshotData( char *&data, const void *src, size_t len, size_t align ) {
+    data = (char *)(((uintptr_t)data + (align - 1)) & ~(uintptr_t)(align - 1));
+    auto r = data;
+    memcpy(data, src, len);
+    data += len;
+    return r;
+}
 
-    char *stack = ctn->base_heap.base;
+// Same walk as PackNodes, with the strings and arrays copied along with the nodes.
+cfg::Node *PackSnapshotNodes( cfg::Node *first, cfg::Node *parent, cfg::Node *&cursor, char *&data, unsigned int *count ) {
+    auto base = cursor;
+    unsigned int k = 0;
+    for (auto n = first; n; n = n->next) {
+        auto copy = &base[k];
+        *copy = *n;
+        copy->parent = parent;
+        copy->flags &= ~(cfg::eNodeFlag_Dirty | cfg::eNodeFlag_Restructured);
+        copy->src_begin = copy->src_end = 0;
+        if (n->name)
+            copy->name = CopySnapshotData(data, n->name, n->name_len + 1, 1);
+        if (n->str)
+            copy->str = CopySnapshotData(data, n->str, strlen(n->str) + 1, 1);
+        if (auto bytes = SnapshotArrayBytes(n))
+            copy->value.array.data = CopySnapshotData(data, n->value.array.data, bytes, 8);
+        ++k;
+    }
+    cursor += k;
+
+    for (unsigned int i = 0; i < k; ++i) {
+        auto n = &base[i];
+        n->next = (i + 1 < k) ? &base[i + 1] : nullptr;
+        n->first_attribute = PackSnapshotNodes(n->first_attribute, n, cursor, data, nullptr);
+        n->first_child = PackSnapshotNodes(n->first_child, n, cursor, data, &n->child_count);
+        n->last_child = n->child_count ? &n->first_child[n->child_count - 1] : nullptr;
+        n->flags |= cfg::eNodeFlag_PackedChildren;
+    }
 
-    // Iterate and store strings.
-    c = source;
-    tmp = c;
+    if (count)
+        *count = k;
+    return k ? base : nullptr;
+}
 
-    cfg::Node *prev = nullptr;
-    
-    while (*c) {
-        if (*c == '<') {
-            if (*(c + 1) == '?' || *(c + 1) == '/') {
-                while (*c != '>') ++c;
-                continue;
-            }
+// Moves every link in the image from 'from' to 'to'.
+void RelocateSnapshot( cfg::Node *nodes, size_t count, uintptr_t from, uintptr_t to ) {
+    auto move = [from, to]( auto &p ) {
+        if (p)
+            p = (std::remove_reference_t<decltype(p)>)((uintptr_t)p - from + to);
+    };
 
-            cfg::Node *node = ParseXmlNode(c, stack, prev, ctn);
-            if (!ctn->first)
-                ctn->first = node;
-            if (prev)
-                prev->next = node;
-            prev = node;
+    for (size_t i = 0; i < count; ++i) {
+        auto n = &nodes[i];
+        move(n->name);
+        move(n->str);
+        move(n->first_attribute);
+        move(n->first_child);
+        move(n->next);
+        move(n->parent);
+        move(n->last_child);
+        if (SnapshotArrayBytes(n))
+            move(n->value.array.data);
+    }
+}
+
+// Somewhere high in the 47-bit address space that another snapshot is unlikely to want.
+uint64_t SnapshotBase( size_t size, unsigned int seed ) {
+    if (sizeof(void *) < 8)
+        return 0;
+    return 0x100000000000ull + ((uint64_t)((seed ^ (unsigned int)size) & 0x3FFF) << 32);
+}
+
+// The image in one cbk::malloc'd block, links already pointing at 'header->base'.
+char *BuildSnapshot( cfg::Container *ctn, size_t *size ) {
+    // Nothing may need writing once the image is mapped.
+    ctn->DecodeStrings();
+    ctn->Classify();
+
+    size_t node_count = 0;
+    size_t data_bytes = 0;
+    MeasureSnapshot(ctn->first, &node_count, &data_bytes);
+
+    size_t nodes_offset = (sizeof(SnapshotHeader) + 63) & ~(size_t)63;
+    size_t total = nodes_offset + (node_count * sizeof(cfg::Node)) + data_bytes + 8;
+
+    auto image = (char *)cfg::cbk::malloc(total);
+    if (!image)
+        return nullptr;
+    memset(image, 0, total);
+
+    auto cursor = (cfg::Node *)(image + nodes_offset);
+    auto data = (char *)(cursor + node_count);
+    PackSnapshotNodes(ctn->first, nullptr, cursor, data, nullptr);
+
+    auto header = (SnapshotHeader *)image;
+    memcpy(header->magic, CFG_SNAPSHOT_MAGIC, sizeof(CFG_SNAPSHOT_MAGIC));
+    header->version = CFG_SNAPSHOT_VERSION;
+    header->endian = CFG_SNAPSHOT_ENDIAN;
+    header->node_size = sizeof(cfg::Node);
+    header->file_type = (uint32_t)ctn->file_type;
+    header->size = total;
+    header->nodes = node_count ? nodes_offset : 0;
+    header->node_count = node_count;
+    header->base = SnapshotBase(total, (unsigned int)node_count * 2654435761u);
+
+    RelocateSnapshot((cfg::Node *)(image + nodes_offset), node_count, (uintptr_t)image, (uintptr_t)header->base);
+    *size = total;
+    return image;
+}
+
+bool CheckSnapshotHeader( const SnapshotHeader *header, size_t size ) {
+    return size >= sizeof(SnapshotHeader)
+        && memcmp(header->magic, CFG_SNAPSHOT_MAGIC, sizeof(CFG_SNAPSHOT_MAGIC)) == 0
+        && header->version == CFG_SNAPSHOT_VERSION
+        && header->endian == CFG_SNAPSHOT_ENDIAN
+        && header->node_size == sizeof(cfg::Node)
+        && header->size == size
+        && header->nodes + header->node_count * sizeof(cfg::Node) <= size;
+}
+
+// Points the container at a checked image that's been placed at 'image'.
+void AdoptSnapshot( cfg::Container *ctn, char *image, size_t size ) {
+    auto header = (SnapshotHeader *)image;
+    auto nodes = (cfg::Node *)(image + header->nodes);
+    if ((uintptr_t)image != header->base)
+        RelocateSnapshot(nodes, header->node_count, (uintptr_t)header->base, (uintptr_t)image);
+
+    ctn->first = header->node_count ? nodes : nullptr;
+    ctn->file_type = (cfg::eFileType)header->file_type;
+    ctn->snapshot = image;
+    ctn->snapshot_size = size;
+}
+
+// Written beside 'path' and renamed over it, so a reader never sees half a file.
+bool WriteFileAtomic( const char *path, const char *data, size_t size ) {
+    size_t path_len = strlen(path);
+    auto tmp = (char *)cfg::cbk::malloc(path_len + 32);
+    if (!tmp)
+        return false;
+#if defined(_WIN32)
+    stbsp_sprintf(tmp, "%s.%u.tmp", path, (unsigned int)_getpid());
+#else
+    stbsp_sprintf(tmp, "%s.%u.tmp", path, (unsigned int)getpid());
+#endif
+
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(data, 1, size, f) == size;
+    if (f)
+        ok = (fclose(f) == 0) && ok;
+
+#if defined(_WIN32)
+    ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, path) == 0;
+#endif
+    if (!ok)
+        remove(tmp);
+    cfg::cbk::free(tmp);
+    return ok;
+}
+
+// 64-bit content hash for the parse cache, four independent lanes of xxh64 style rounds.
+inline uint64_t HashRotate( uint64_t v, int r ) { return (v << r) | (v >> (64 - r)); }
+
+inline uint64_t HashRound( uint64_t acc, uint64_t v ) {
+    return HashRotate(acc + v * 0xC2B2AE3D27D4EB4Full, 31) * 0x9E3779B185EBCA87ull;
+}
+
+uint64_t HashBytes( const char *data, size_t len ) {
+    const uint64_t p1 = 0x9E3779B185EBCA87ull;
+    const uint64_t p2 = 0xC2B2AE3D27D4EB4Full;
+    auto c = data;
+    auto end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t acc[4] = { p1 + p2, p2, 0, 0 - p1 };
+        for (; c + 32 <= end; c += 32) {
+            uint64_t v[4];
+            memcpy(v, c, 32);
+            acc[0] = HashRound(acc[0], v[0]);
+            acc[1] = HashRound(acc[1], v[1]);
+            acc[2] = HashRound(acc[2], v[2]);
+            acc[3] = HashRound(acc[3], v[3]);
         }
+        h = HashRotate(acc[0], 1) + HashRotate(acc[1], 7) + HashRotate(acc[2], 12) + HashRotate(acc[3], 18);
+        for (int i = 0; i < 4; ++i)
+            h = (h ^ HashRound(0, acc[i])) * p1 + 0x85EBCA77C2B2AE63ull;
+    }
+    else
+        h = 0x27D4EB2F165667C5ull;
+
+    h += (uint64_t)len;
+    for (; c + 8 <= end; c += 8) {
+        uint64_t v;
+        memcpy(&v, c, 8);
+        h = HashRotate(h ^ HashRound(0, v), 27) * p1 + 0x85EBCA77C2B2AE63ull;
+    }
+    for (; c < end; ++c)
+        h = HashRotate(h ^ ((unsigned char)*c * 0x27D4EB2F165667C5ull), 11) * p1;
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= 0x165667B19E3779F9ull;
+    h ^= h >> 32;
+    return h;
+}
 
-        ++c;
+// Reads a whole file into a NUL terminated cbk::malloc'd buffer.
+char *ReadFile( const char *path, size_t *len ) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return nullptr;
+
+    char *buffer = nullptr;
+    long size = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+    if (size >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        buffer = (char *)cfg::cbk::malloc((size_t)size + 1);
+        if (buffer && fread(buffer, 1, (size_t)size, f) != (size_t)size) {
+            cfg::cbk::free(buffer);
+            buffer = nullptr;
+        }
     }
+    fclose(f);
 
-    // Allocate growth heap.
-    ctn->base_heap.next = (cfg::Heap *)cfg::cbk::malloc(sizeof(cfg::Heap) + CFG_HEAP_SIZE);
-    ctn->heap = ctn->base_heap.next;
-    ctn->heap->base = (char *)(((uintptr_t)ctn->heap) + sizeof(cfg::Heap));
-    ctn->heap->ceiling = ctn->heap->base + CFG_HEAP_SIZE;
-    ctn->heap->free = ctn->heap->base;
-    ctn->heap->next = nullptr;
-    memset(ctn->heap->base, 0, CFG_HEAP_SIZE);
+    if (!buffer)
+        return nullptr;
+    buffer[size] = 0;
+    *len = (size_t)size;
+    return buffer;
+}
 
-    return true;
+/// ------------------- ///
+/// ---- Container ---- ///
+bool cfg::Container::Parse(char *source, size_t len, eFileType type) {
+    g_curr_container = this;
+    cfg::Container *ctn = this;
+
+    generation = ++g_generation_counter;
+    top_flags = 0;
+    last = nullptr;
+    versions = nullptr;
+    shared = false;
+    snapshot = nullptr;
+    snapshot_size = 0;
+    file_buffer = nullptr;
+    this->source = source;
+    source_len = len;
+
+    switch (type) {
+        case eFileType_Ini: return ParseIni(this, source, len);
+        case eFileType_Xml: return ParseXml(this, source, len);
+        case eFileType_Json: return ParseJson(this, source, len);
+        case eFileType_Yaml: return ParseYaml(this, source, len);
+        case eFileType_Cbor: return ParseCbor(this, source, len);
+        case eFileType_MsgPack: return ParseMsgPack(this, source, len);
+    }
+    return false;
 }
 
-size_t MeasureXmlNodeStrings( cfg::Node *n, int depth ) {
-    size_t total = depth; // '\t...'
+// The format's own printer.
+bool PrintFormat( cfg::Container *ctn, PrintBuffer &out, cfg::eFileType type, bool compact ) {
+    switch (type) {
+        case cfg::eFileType_Ini: PrintIni(ctn, out, compact); return true;
+        case cfg::eFileType_Xml: PrintXml(ctn, out, compact); return true;
+        case cfg::eFileType_Json: PrintJson(ctn, out, compact); return true;
+        case cfg::eFileType_Yaml: PrintYaml(ctn, out, compact); return true;
+        case cfg::eFileType_Cbor: PrintCbor(ctn, out); return true;
+        case cfg::eFileType_MsgPack: PrintMsgPack(ctn, out); return true;
+        default: return false;
+    }
+}
 
-    auto name_len = cfg::StringLength(n->name);
-    total += name_len + 1; // '<*name*'
-    if (n->str)
-        total += cfg::StringLength(n->str) + name_len + 3; // '>*str*</*name*>'
+bool PrintContainer( cfg::Container *ctn, PrintBuffer &out, cfg::eFileType target, const cfg::PrintOptions &options ) {
+    out.indent = options.indent;
+    out.indent_width = options.indent_width;
 
-    auto a = n->first_attribute;
-    while (a) {
-        total += (cfg::StringLength(a->name) + cfg::StringLength(a->str) + 4); // ' *name*="*str*"'
-        a = a->next;
+    if (target != ctn->file_type) {
+        // JSON, CBOR and MessagePack share one tree, they print as each other directly.
+        if (IsJsonTree(ctn->file_type) && IsJsonTree(target))
+            return PrintFormat(ctn, out, target, options.compact);
+        return (ctn->file_type != cfg::eFileType_Unknown) && ConvertContainer(ctn, out, target, options.compact);
     }
 
-    if (!n->first_child && !n->str) {
-        total += 3; // '/>\n'
-        return total;
+    // Unchanged nodes are copied from the source. That keeps their original layout, so a compact print is a full one.
+    if (options.incremental && !options.compact && ctn->source) {
+        switch (ctn->file_type) {
+            case cfg::eFileType_Ini: PrintIniIncremental(ctn, out); return true;
+            case cfg::eFileType_Xml: PrintXmlIncremental(ctn, out); return true;
+            case cfg::eFileType_Json: PrintJsonIncremental(ctn, out); return true;
+            default: break;
+        }
     }
 
-    total++; // '\n'
+    if (options.threads != 1 && PrintParallel(ctn, out, options))
+        return true;
 
-    for (auto c = n->first_child; c != nullptr; c = c->next) {
-        total += MeasureXmlNodeStrings(c, depth + 1);
-    }
+    return PrintFormat(ctn, out, ctn->file_type, options.compact);
+}
 
-    return total;
+size_t cfg::Container::Print(char **dst, const PrintOptions &options) {
+    return Print(dst, file_type, options);
 }
 
-size_t MeasureXmlStrings( cfg::Container *ctn ) {
-    size_t total = 1; 
+size_t cfg::Container::Print(char **dst, eFileType target, const PrintOptions &options) {
+    PrintBuffer out;
+    *dst = nullptr;
+    if (!out.Grow(0))
+        return 0;
 
-#if 0
-    for (auto n = ctn->first; n != nullptr; n = n->next) {
-        total += MeasureXmlNodeStrings(n, 0);
+    if (!PrintContainer(this, out, target, options)) {
+        cbk::free(out.base);
+        return 0;
     }
-#endif
 
-    auto heap = &ctn->base_heap;
-    while (heap) {
-        total += heap->free - heap->base;
-        heap = heap->next;
+    out.Put(0);
+    if (out.failed) {
+        cbk::free(out.base);
+        return 0;
     }
 
-    return total;
+    *dst = out.base;
+    return (out.c - out.base) - 1;
 }
 
-void PrintXmlNode( cfg::Node *node, char *&c, int depth ) {
-    CFG_PRINT_TABS(c, depth);
-
-    stbsp_sprintf(c, "<%s", node->name);
-    (c, 0);
+bool cfg::Container::Write(Sink &sink, const PrintOptions &options) {
+    return Write(sink, file_type, options);
+}
 
-    for (auto a = node->first_attribute; a != nullptr; a = a->next) {
-        stbsp_sprintf(c, " %s=\"%s\"", a->name, a->str);
-        (c, 0);
-    }
+bool cfg::Container::Write(Sink &sink, eFileType target, const PrintOptions &options) {
+    PrintBuffer out;
+    out.sink = &sink;
+    if (!out.Grow(CFG_SINK_BUFFER_SIZE))
+        return false;
 
-    if (!node->first_child && !node->str) {
-        *c = '/';
-        *(c + 1) = '>';
-        *(c + 2) = '\n';
-        c += 3;
-        return;
-    }
+    if (!PrintContainer(this, out, target, options))
+        out.failed = true;
 
-    *c = '>';
-    ++c;
+    out.Flush();
+    cbk::free(out.base);
+    return !out.failed;
+}
 
-    if (node->str) {
-        stbsp_sprintf(c, "%s</%s>\n", node->str, node->name);
-        (c, 0);
-        return;
+void cfg::Container::Release() {
+    ReleaseHeap(&base_heap);
+    cbk::free(base_heap.base);
+    heap = nullptr;
+    first = nullptr;
+    last = nullptr;
+    versions = nullptr;
+    shared = false;
+    file_type = eFileType_Unknown;
+    generation = ++g_generation_counter;
+    top_flags = 0;
+    source = nullptr;
+    source_len = 0;
+
+    cbk::free(file_buffer);
+    file_buffer = nullptr;
+
+    if (snapshot) {
+#if defined(_WIN32)
+        cbk::free(snapshot);
+#else
+        munmap(snapshot, snapshot_size);
+#endif
+        snapshot = nullptr;
+        snapshot_size = 0;
     }
+}
 
-    *c = '\n';
-    ++c;
+bool cfg::Container::ParseFile(const char *path, eFileType type, const char *cache_dir) {
+    size_t len;
+    char *buffer = ReadFile(path, &len);
+    if (!buffer)
+        return false;
 
-    for (auto child = node->first_child; child != nullptr; child = child->next) {
-        PrintXmlNode(child, c, depth + 1);
+    // Parse and LoadSnapshot forget the previous file's buffer, it's freed here instead.
+    cbk::free(file_buffer);
+    file_buffer = nullptr;
+
+    // Cache entries are named after the contents, the format and the snapshot layout, so a changed file or
+    // a different build just misses.
+    char *entry = nullptr;
+    if (cache_dir) {
+        entry = (char *)cbk::malloc(strlen(cache_dir) + 64);
+        if (entry) {
+            stbsp_sprintf(entry, "%s/%016llx-%u-%u-%u.cfgsnap", cache_dir, (unsigned long long)HashBytes(buffer, len),
+                (unsigned int)type, (unsigned int)CFG_SNAPSHOT_VERSION, (unsigned int)sizeof(Node));
+            if (LoadSnapshot(entry)) {
+                cbk::free(entry);
+                cbk::free(buffer);
+                return true;
+            }
+        }
     }
 
-    CFG_PRINT_TABS(c, depth);
-    stbsp_sprintf(c, "</%s>\n", node->name);
-    (c, 0);
+    if (!Parse(buffer, len, type)) {
+        cbk::free(entry);
+        cbk::free(buffer);
+        return false;
+    }
+    file_buffer = buffer;
+
+    // A cache that can't be written to only costs the next start its parse.
+    if (entry) {
+#if defined(_WIN32)
+        CreateDirectoryA(cache_dir, nullptr);
+#else
+        mkdir(cache_dir, 0755);
+#endif
+        SaveSnapshot(entry);
+        cbk::free(entry);
+    }
+    return true;
 }
 
-size_t PrintXml( cfg::Container *ctn, char **dst ) {
-    size_t total = MeasureXmlStrings(ctn);
+bool cfg::Container::SaveSnapshot(const char *path) {
+    size_t size;
+    auto image = BuildSnapshot(this, &size);
+    if (!image)
+        return false;
 
-    *dst = (char *)cfg::cbk::malloc(total);
-    memset(*dst, 0, total);
+    bool ok = WriteFileAtomic(path, image, size);
+    cbk::free(image);
+    return ok;
+}
 
-    char *c = *dst;
+bool cfg::Container::LoadSnapshot(const char *path) {
+    SnapshotHeader header;
+    char *image = nullptr;
+    size_t size = 0;
 
-    for (auto n = ctn->first; n != nullptr; n = n->next) {
-        PrintXmlNode(n, c, 0);
+#if defined(_WIN32)
+    // No preferred base here, the image is read in and relocated.
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    bool ok = fread(&header, 1, sizeof(header), f) == sizeof(header) && fseek(f, 0, SEEK_END) == 0;
+    long end = ok ? ftell(f) : -1;
+    ok = ok && end > 0 && CheckSnapshotHeader(&header, (size_t)end);
+    if (ok) {
+        size = (size_t)end;
+        image = (char *)cbk::malloc(size);
+        ok = image && fseek(f, 0, SEEK_SET) == 0 && fread(image, 1, size, f) == size;
+    }
+    fclose(f);
+    if (!ok) {
+        cbk::free(image);
+        return false;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || !CheckSnapshotHeader(&header, (size_t)st.st_size)) {
+        close(fd);
+        return false;
     }
+    size = (size_t)st.st_size;
+
+    // Private pages stay shared with the page cache until written. At the preferred base nothing is written at all.
+    void *map = MAP_FAILED;
+    if (header.base)
+        map = mmap((void *)(uintptr_t)header.base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+    if (map == MAP_FAILED)
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    image = (char *)map;
+#endif
 
-    return total;
+    g_curr_container = this;
+    base_heap = {};
+    heap = nullptr;
+    source = nullptr;
+    source_len = 0;
+    top_flags = 0;
+    last = nullptr;
+    versions = nullptr;
+    shared = false;
+    snapshot = nullptr;
+    snapshot_size = 0;
+    file_buffer = nullptr;
+    generation = ++g_generation_counter;
+    AdoptSnapshot(this, image, size);
+    return true;
 }
-#endif // CFGPARSE_XML
 
-#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
-cfg::Node *ParseJsonNode( char *&c, char *&stack, cfg::Node *parent ) {
-    auto node = (cfg::Node *)stack;
-    stack += sizeof(cfg::Node);
+void cfg::Container::MarkDirty(Node *node, bool restructured) {
+    if (restructured) {
+        if (node)
+            node->flags |= eNodeFlag_Restructured;
+        else
+            top_flags |= eNodeFlag_Restructured;
+    }
 
-    if (*c == ':') {
-        --c;
-        while (*c != '"') --c;
-        auto tmp = c;
-        --c;
-        while (*c != '"') --c;
-        ++c;
+    // Everything above a change is dirty too. Stop early once a node already is.
+    for (auto n = node; n; n = n->parent) {
+        if ((n->flags & eNodeFlag_Dirty) && n != node)
+            break;
+        n->flags |= eNodeFlag_Dirty;
+    }
+    top_flags |= eNodeFlag_Dirty;
+    generation = ++g_generation_counter;
+}
 
-        memcpy(stack, c, tmp - c);
-        node->name = stack;
-        stack += ((tmp - c) + 1);
+void *cfg::Container::Allocate(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    if (!heap || (heap->free + size) > heap->ceiling) {
+        size_t heap_size = heap ? (size_t)(heap->ceiling - heap->base) * 2 : CFG_HEAP_SIZE;
+        if (heap_size > CFG_HEAP_SIZE_MAX)
+            heap_size = CFG_HEAP_SIZE_MAX;
+        if (heap_size < size)
+            heap_size = size;
+        auto h = (cfg::Heap *)cfg::cbk::malloc(sizeof(cfg::Heap) + heap_size);
+        if (!h)
+            return nullptr;
+        h->base = (char *)(((uintptr_t)h) + sizeof(cfg::Heap));
+        h->ceiling = h->base + heap_size;
+        h->free = h->base;
+        h->next = nullptr;
+        memset(h->base, 0, heap_size);
+
+        // Heaps are released by walking the chain from base_heap. The current heap is the last one, except
+        // before the first allocation.
+        auto tail = heap ? heap : &base_heap;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = h;
+        heap = h;
+    }
 
-        while (*c != ':') ++c;
-        tmp = c;
-        ++c;
+    auto r = heap->free;
+    heap->free += size;
+    return r;
+}
 
-        while (CFG_IS_WHITESPACE(*c)) ++c;
+cfg::Node *cfg::Container::GetNode(char *name, unsigned int depth) {
+    auto len = (unsigned int)cfg::StringLength(name);
+    return FindTopNode(first, name, len, cfg::HashString(name, len), depth);
+}
 
-        // If the next thing is a string...
-        if (*c == '"') {
-            ++c;
-            tmp = c;
-            while (*c != '"') ++c;
+cfg::Node *cfg::Container::GetNode(Key key, unsigned int depth) {
+    return FindTopNode(first, key.name, key.len, key.hash, depth);
+}
 
-            memcpy(stack, tmp, (c - tmp));
-            node->str = stack;
-            stack += ((c - tmp) + 1);
+cfg::Node *cfg::Container::Resolve(Path &path) {
+    if (versions || shared)
+        return ResolvePathNodes(first, path, nullptr);
+    if (path.cached_owner == this && path.cached_generation == generation)
+        return path.cached_node;
 
-            return node;
-        }
+    path.cached_node = ResolvePathNodes(first, path, nullptr);
+    path.cached_owner = this;
+    path.cached_generation = generation;
+    return path.cached_node;
+}
 
-        // If the next thing is an array.
-        if (*c == '[') {
-            cfg::Node *prev_arr_node = nullptr;
+bool cfg::Container::EnableVersions() {
+    if (versions)
+        return true;
 
-            while (*c != ']') {
-                if (*c == '"') {
-                    cfg::Node *new_node = (cfg::Node *)stack;
-                    stack += sizeof(cfg::Node);
+    // Readers must never write, so everything a lookup would decode or cache is done now.
+    DecodeStrings();
+    Classify();
 
-                    ++c;
-                    tmp = c;
-                    while (*c != '"') ++c;
-                    memcpy(stack, tmp, (c - tmp));
-                    new_node->str = stack;
-                    stack += ((c - tmp) + 1);
-
-                    if (prev_arr_node)
-                        prev_arr_node->next = new_node;
-                    prev_arr_node = new_node;
-                    if (!node->first_child)
-                        node->first_child = new_node;
-                }
+    auto state = (VersionState *)Allocate(sizeof(VersionState));
+    auto version = (Version *)Allocate(sizeof(Version));
+    if (!state || !version)
+        return false;
 
-                if (*c == '{') {
-                    auto new_node = ParseJsonNode(c, stack, node);
-                
-                    if (prev_arr_node)
-                        prev_arr_node->next = new_node;
-                    prev_arr_node = new_node;
-                    if (!node->first_child)
-                        node->first_child = new_node;
-                }
+    version->first = first;
+    version->number = 1;
+    version->generation = generation;
+    new (state) VersionState{};
+    state->current.store(version, std::memory_order_release);
+    versions = state;
+    return true;
+}
 
-                ++c;
-            }
+cfg::Version *cfg::Container::Current() {
+    return versions ? versions->current.load(std::memory_order_acquire) : nullptr;
+}
 
-            return node;
-        }
-    }
+cfg::Version *cfg::Container::SetString(Path &path, const char *str) {
+    return PublishVersionEdit(this, path, eVersionEdit_SetString, nullptr, str);
+}
 
-    // If the next thing is a set of children...
-    if (*c == '{') {
-        cfg::Node *prev_child = nullptr;        
+cfg::Version *cfg::Container::AppendChild(Path &parent, const char *name, const char *str) {
+    return PublishVersionEdit(this, parent, eVersionEdit_Append, name, str);
+}
 
-        while (*c != '}') {
-            if (*c == ':') {
-                auto child = ParseJsonNode(c, stack, node);
+cfg::Version *cfg::Container::Remove(Path &path) {
+    return PublishVersionEdit(this, path, eVersionEdit_Remove, nullptr, nullptr);
+}
 
-                if (prev_child)
-                    prev_child->next = child;
-                prev_child = child;
-                if (!node->first_child)
-                    node->first_child = child;
-            }
-    
-            ++c;
-        }
+void ClassifyNodes( cfg::Node *first ) {
+    for (auto n = first; n; n = n->next) {
+        n->Classify();
+        ClassifyNodes(n->first_attribute);
+        ClassifyNodes(n->first_child);
     }
-
-    return node;
 }
 
-bool ParseJson( cfg::Container *ctn, char *source, size_t len ) {
-    auto c = source;
-    auto tmp = c;
-    size_t total = 0;
+void cfg::Container::Classify() {
+    ClassifyNodes(first);
+}
 
-    // The first character MUST be a '{'.
-    while (CFG_IS_WHITESPACE(*c)) ++c;
-    if (*c != '{')
-        return false;
+void DecodeNodeStrings( cfg::Node *first ) {
+    for (auto n = first; n; n = n->next) {
+        n->GetString();
+        DecodeNodeStrings(n->first_attribute);
+        DecodeNodeStrings(n->first_child);
+    }
+}
 
-    while (*c) {
-        while (CFG_IS_WHITESPACE(*c)) ++c;
+void cfg::Container::DecodeStrings() {
+    DecodeNodeStrings(first);
+}
 
-        switch (*c) {
-            case ':': total += sizeof(cfg::Node); break;
-            case '"':{
-                         ++c;
-                         tmp = c;
-                         while (*c != '"') ++c;
-                         total += CFG_SIZE(tmp, c);
-                     } break;
-            case '[': total += sizeof(cfg::Node); break;
-        }
+size_t CountNodes( cfg::Node *first ) {
+    size_t count = 0;
+    for (auto n = first; n; n = n->next)
+        count += 1 + CountNodes(n->first_attribute) + CountNodes(n->first_child);
+    return count;
+}
 
-        ++c;
+// Copies a sibling list into the next free slots at 'cursor', then does the same for each copy's
+// attributes and children. Every sibling list ends up contiguous.
+cfg::Node *PackNodes( cfg::Node *first, cfg::Node *parent, cfg::Node *&cursor, unsigned int *count ) {
+    auto base = cursor;
+    unsigned int k = 0;
+    for (auto n = first; n; n = n->next) {
+        base[k] = *n;
+        base[k].parent = parent;
+        ++k;
+    }
+    cursor += k;
+
+    for (unsigned int i = 0; i < k; ++i) {
+        auto n = &base[i];
+        n->next = (i + 1 < k) ? &base[i + 1] : nullptr;
+        n->first_attribute = PackNodes(n->first_attribute, n, cursor, nullptr);
+        n->first_child = PackNodes(n->first_child, n, cursor, &n->child_count);
+        n->last_child = n->child_count ? &n->first_child[n->child_count - 1] : nullptr;
+        n->flags |= cfg::eNodeFlag_PackedChildren;
     }
 
-    // FIXME: Something about the measurements isn't right, and at some point during parsing we end up overflowing the buffer.
-    //        This addition is just a hack to ensure we have enough space. I have no idea if it scales with file size. 
-    //        ~ dalex
-    total += 512;
+    if (count)
+        *count = k;
+    return k ? base : nullptr;
+}
 
-    // Allocate
-    ctn->base_heap.base = (char *)cfg::cbk::malloc(total);
-    memset(ctn->base_heap.base, 0, total);
-    ctn->base_heap.ceiling = (ctn->base_heap.base + total);
-    ctn->base_heap.free = ctn->base_heap.ceiling;
-    ctn->base_heap.next = nullptr;
+bool cfg::Container::Finalize() {
+    size_t count = CountNodes(first);
+    if (!count)
+        return true;
 
-    c = source;
-    char *stack = ctn->base_heap.base;
+    auto cursor = (cfg::Node *)Allocate(count * sizeof(cfg::Node));
+    if (!cursor)
+        return false;
 
-    ctn->first = nullptr;
-    cfg::Node *prev_node = nullptr;
+    unsigned int top_count;
+    first = PackNodes(first, nullptr, cursor, &top_count);
+    last = top_count ? &first[top_count - 1] : nullptr;
+    generation = ++g_generation_counter;
+    return true;
+}
 
-    while (*c) {
-        if (*c == ':') {
-            auto node = ParseJsonNode(c, stack, nullptr);
-            if (prev_node)
-                prev_node->next = node;
-            prev_node = node;
-            if (!ctn->first)
-                ctn->first = node;
-        }
-        ++c;
-    }
+size_t cfg::Container::Select(XPath &xpath, Node **out, size_t max) {
+    if (!xpath.count || !max)
+        return 0;
 
-    // Allocate subsequent heap.
-    ctn->base_heap.next = (cfg::Heap *)cfg::cbk::malloc(sizeof(cfg::Heap) + CFG_HEAP_SIZE);
-    ctn->heap = ctn->base_heap.next;
-    ctn->heap->base = (char *)(((uintptr_t)ctn->heap) + sizeof(cfg::Heap));
-    ctn->heap->ceiling = (char *)(((uintptr_t)ctn->heap->base) + CFG_HEAP_SIZE);
-    ctn->heap->free = ctn->heap->base;
+    XPathQuery q = { &xpath, out, max, 0 };
+    EvaluateXPathStep(&q, 0, nullptr, first);
+    return q.found;
+}
 
-    ctn->file_type = cfg::eFileType_Json;
-    return true;
+cfg::Node *cfg::Container::SelectFirst(XPath &xpath) {
+    cfg::Node *n = nullptr;
+    Select(xpath, &n, 1);
+    return n;
 }
 
-size_t MeasureJsonNodeStrings (cfg::Node *n, int depth ) {
-    size_t total = depth + 6; // '"..." : ...\n'
 
-    // The node wouldn't have a name if it was an element in an array.
-    if (n->name)
-        total += cfg::StringLength(n->name);
+/// ---- Live config ---- ///
+// Hazard pointers: a reader announces the container it's about to use in its slot, then checks it's still the
+// current one. A retired container is only released once no slot points at it, so readers never wait for the
+// writer and the writer never waits for readers, it just leaves busy containers for a later reclaim.
+struct alignas(64) LiveSlot { // One per cache line, readers don't share lines.
+    std::atomic<cfg::Container *> hazard;
+    std::atomic<bool> used;
+};
+
+struct RetiredContainer {
+    cfg::Container *ctn;
+    RetiredContainer *next;
+};
+
+// A file reload waiting for the background worker. Both strings live in the same allocation.
+struct LiveRequest {
+    char *path;
+    char *cache_dir;
+    cfg::eFileType type;
+};
+
+struct cfg::LiveState {
+    std::atomic<cfg::Container *> current;
+    LiveSlot slots[CFG_LIVE_READERS_MAX];
+    RetiredContainer *retired; // Writer only.
+    void *allocation;          // cbk::malloc doesn't promise cache line alignment.
+#if !defined(CFGPARSE_NO_THREADS)
+    std::mutex writer;
+    std::mutex queue;          // Guards everything below.
+    std::thread worker;
+    LiveRequest pending;       // The newest request not started yet, 'path' is nullptr if there's none.
+    bool running;              // The worker is (still) taking requests.
+#endif
+};
+
+cfg::LiveState *CreateLiveState() {
+    auto allocation = cfg::cbk::malloc(sizeof(cfg::LiveState) + 63);
+    if (!allocation)
+        return nullptr;
+    auto state = new ((void *)(((uintptr_t)allocation + 63) & ~(uintptr_t)63)) cfg::LiveState();
+    state->allocation = allocation;
+    return state;
+}
 
-    // n->str and n->first_child are mutually exclusive.
-    if (n->str)
-        total += cfg::StringLength(n->str) + 2; // : '"..."'
-    else if (n->first_child) {
-        total += 2; // '{}' || '[]';
+void ReleaseLiveContainer( cfg::Container *ctn ) {
+    ctn->Release();
+    cfg::cbk::free(ctn);
+}
 
-        auto c = n->first_child;
-        while (c) {
-            total += MeasureJsonNodeStrings(c, depth + 1);
-            c = c->next;
+// Releases every retired container that no reader holds any more.
+void ReclaimRetired( cfg::LiveState *state ) {
+    auto link = &state->retired;
+    while (*link) {
+        auto r = *link;
+        bool held = false;
+        for (unsigned int i = 0; i < CFG_LIVE_READERS_MAX && !held; ++i)
+            held = (state->slots[i].hazard.load() == r->ctn);
+
+        if (held) {
+            link = &r->next;
+            continue;
         }
+        *link = r->next;
+        ReleaseLiveContainer(r->ctn);
+        cfg::cbk::free(r);
     }
-
-    return total;
 }
 
-void PrintJsonNode( cfg::Node *n, char *&c, int depth ) {
-    CFG_PRINT_TABS(c, depth);
+// Takes a fully built container, makes it current and retires the old one.
+bool PublishLive( cfg::LiveConfig *live, cfg::Container *ctn ) {
+    // Readers only ever read, everything they could decode or cache is done here.
+    ctn->DecodeStrings();
+    ctn->Classify();
+    ctn->shared = true;
 
-    if (n->name)
-        c += stbsp_sprintf(c, "\"%s\" : ", n->name);
+    auto retired = (RetiredContainer *)cfg::cbk::malloc(sizeof(RetiredContainer));
+    if (!retired) {
+        ReleaseLiveContainer(ctn);
+        return false;
+    }
 
-    if (n->str) {
-        c += stbsp_sprintf(c, "\"%s\"", n->str);
-        if (n->next) {
-            *c = ',';
-            ++c;
-        }
-        *c = '\n';
-        ++c;
-        return;
+    auto state = live->state;
+#if !defined(CFGPARSE_NO_THREADS)
+    std::lock_guard<std::mutex> lock(state->writer);
+#endif
+    retired->ctn = state->current.exchange(ctn);
+    if (retired->ctn) {
+        retired->next = state->retired;
+        state->retired = retired;
     }
+    else
+        cfg::cbk::free(retired);
 
-    if (n->first_child) {
-        // If the children are part of an array, they won't have names.
-        if (!n->first_child->name) {
-            *c = '[';
-            ++c;
+    ReclaimRetired(state);
+    return true;
+}
 
-            auto arr_child = n->first_child;
-            while (arr_child) {
+cfg::Container *NewLiveContainer() {
+    auto ctn = (cfg::Container *)cfg::cbk::malloc(sizeof(cfg::Container));
+    if (ctn)
+        memset(ctn, 0, sizeof(cfg::Container));
+    return ctn;
+}
 
-                if (arr_child->str) {
-                    c += stbsp_sprintf(c, " \"%s\"", arr_child->str);
+bool cfg::LiveConfig::Init() {
+    if (!state)
+        state = CreateLiveState();
+    return state != nullptr;
+}
 
-                    if ( arr_child->next ) {
-                        *c = ',';
-                        ++c;
-                    }
-                }
-                // If the child has children, it's the start of a new set of nodes.
-                else if (arr_child->first_child) {
-                    *c = '{';
-                    *(++c) = '\n';
-                    ++c;
+bool cfg::LiveConfig::Reload(const char *source, size_t len, eFileType type) {
+    if (!state)
+        return false;
 
-                    auto arr_element = arr_child->first_child;
-                    while (arr_element) {
-                        PrintJsonNode(arr_element, c, depth + 1);
-                        arr_element = arr_element->next;
-                    }
-                }
+    // The container keeps its own copy, so the caller's buffer can go and incremental printing still works.
+    auto ctn = NewLiveContainer();
+    auto copy = (char *)cbk::malloc(len + 1);
+    if (!ctn || !copy) {
+        cbk::free(ctn);
+        cbk::free(copy);
+        return false;
+    }
+    memcpy(copy, source, len);
+    copy[len] = 0;
 
-                arr_child = arr_child->next;
-            }
+    if (!ctn->Parse(copy, len, type)) {
+        ctn->file_buffer = copy;
+        ReleaseLiveContainer(ctn);
+        return false;
+    }
+    ctn->file_buffer = copy;
+    return PublishLive(this, ctn);
+}
 
-            *c = ']';
-            ++c;
-            if ( n->next ) {
-                *c = ',';
-                ++c;
-            }
-            *c = '\n';
-            ++c;
+bool cfg::LiveConfig::ReloadFile(const char *path, eFileType type, const char *cache_dir) {
+    if (!state)
+        return false;
 
-            return;
-        }
-        // Default child behavior.
-        else {
-            *c = '{';
-            *(++c) = '\n';
-            ++c;
+    auto ctn = NewLiveContainer();
+    if (!ctn)
+        return false;
+    if (!ctn->ParseFile(path, type, cache_dir)) {
+        ReleaseLiveContainer(ctn);
+        return false;
+    }
+    return PublishLive(this, ctn);
+}
 
-            auto child = n->first_child;
-            while (child) {
-                PrintJsonNode(child, c, depth + 1);
-                child = child->next;
+#if !defined(CFGPARSE_NO_THREADS)
+// Loads requests until none are left. 'running' is cleared under the lock, so a request either gets picked up
+// here or finds the worker gone and starts a new one.
+void RunLiveWorker( cfg::LiveConfig *live ) {
+    auto state = live->state;
+    for (;;) {
+        LiveRequest request;
+        {
+            std::lock_guard<std::mutex> lock(state->queue);
+            request = state->pending;
+            state->pending.path = nullptr;
+            if (!request.path) {
+                state->running = false;
+                return;
             }
         }
+        live->ReloadFile(request.path, request.type, request.cache_dir);
+        cfg::cbk::free(request.path);
     }
-
-    CFG_PRINT_TABS(c, depth);
-    *c = '}';
-    ++c;
-    if ( n->next ) {
-        *c = ',';
-        ++c;
-    }
-    *c = '\n';
-    ++c;
 }
+#endif
 
-size_t PrintJson( cfg::Container *ctn, char **dst ) {
-    size_t total = 1; // '\0'
+bool cfg::LiveConfig::ReloadFileAsync(const char *path, eFileType type, const char *cache_dir) {
+#if defined(CFGPARSE_NO_THREADS)
+    return ReloadFile(path, type, cache_dir);
+#else
+    if (!state)
+        return false;
 
-    auto n = ctn->first;
-    while (n) {
-        total += MeasureJsonNodeStrings(n, 0);
-        n = n->next;
+    // The worker gets its own copies of the strings, they're only needed until it's done with them.
+    size_t path_len = strlen(path) + 1;
+    size_t dir_len = cache_dir ? strlen(cache_dir) + 1 : 0;
+    auto strings = (char *)cbk::malloc(path_len + dir_len);
+    if (!strings)
+        return false;
+    memcpy(strings, path, path_len);
+    if (cache_dir)
+        memcpy(strings + path_len, cache_dir, dir_len);
+
+    std::lock_guard<std::mutex> lock(state->queue);
+    cbk::free(state->pending.path); // Superseded before it was started.
+    state->pending = { strings, cache_dir ? strings + path_len : nullptr, type };
+    if (state->running)
+        return true;
+
+    // The previous worker has already left its loop, so this join doesn't wait on a reload.
+    if (state->worker.joinable())
+        state->worker.join();
+    try {
+        state->worker = std::thread(RunLiveWorker, this);
     }
-
-    // Do the printing.
-    // FIXME: See the FIXME note in ParseJson for details on hacking this.
-    total += 512;
-    *dst = (char *)cfg::cbk::malloc(total);
-    memset(*dst, 0, total);
-
-    g_curr_dst_buffer = *dst;
-
-    char *c = *dst;
-    *c = '{';
-    *(c + 1) = '\n';
-    c += 2;
-
-    n = ctn->first;
-    while (n) {
-        PrintJsonNode(n, c, 1);
-        n = n->next;
+    catch (...) {
+        state->pending.path = nullptr;
+        cbk::free(strings);
+        return false;
     }
-
-    *c = '}';
-    return total;
-}
-#endif // CFGPARSE_JSON
-
-#if defined(CFGPARSE_JSON) || defined(CFGPARSE_ALL)
-bool ParseYaml( cfg::Container *ctn, char *source, size_t len ) {
+    state->running = true;
     return true;
+#endif
 }
 
-size_t PrintYaml( cfg::Container *ctn, char **dst ) {
-    return 0;
+unsigned int cfg::LiveConfig::Register() {
+    if (!state)
+        return CFG_LIVE_NO_READER;
+    for (unsigned int i = 0; i < CFG_LIVE_READERS_MAX; ++i) {
+        bool expected = false;
+        if (!state->slots[i].used.load(std::memory_order_relaxed) && state->slots[i].used.compare_exchange_strong(expected, true))
+            return i;
+    }
+    return CFG_LIVE_NO_READER;
 }
-#endif // CFGPARSE_JSON
 
-/// ------------------- ///
-/// ---- Container ---- ///
-bool cfg::Container::Parse(char *source, size_t len, eFileType type) {
-    g_curr_container = this;
-    cfg::Container *ctn = this;
+void cfg::LiveConfig::Unregister(unsigned int reader) {
+    if (!state || reader >= CFG_LIVE_READERS_MAX)
+        return;
+    state->slots[reader].hazard.store(nullptr, std::memory_order_release);
+    state->slots[reader].used.store(false, std::memory_order_release);
+}
 
-    switch (type) {
-        case eFileType_Ini: return ParseIni(this, source, len);
-        case eFileType_Xml: return ParseXml(this, source, len);
-        case eFileType_Json: return ParseJson(this, source, len);
-        case eFileType_Yaml: return ParseYaml(this, source, len);
+cfg::Container *cfg::LiveConfig::Acquire(unsigned int reader) {
+    if (!state || reader >= CFG_LIVE_READERS_MAX)
+        return nullptr;
+
+    // Announce, then make sure it wasn't retired in between. A reload in that gap just means one more try.
+    auto &hazard = state->slots[reader].hazard;
+    auto ctn = state->current.load(std::memory_order_acquire);
+    for (;;) {
+        hazard.store(ctn);
+        auto again = state->current.load();
+        if (again == ctn)
+            return ctn;
+        ctn = again;
     }
-    return false;
 }
 
-size_t cfg::Container::Print(char **dst) {
-    switch (file_type) {
-        case eFileType_Ini: return PrintIni(this, dst);
-        case eFileType_Xml: return PrintXml(this, dst);
-        case eFileType_Json: return PrintJson(this, dst);
-        case eFileType_Yaml: return PrintYaml(this, dst);
-    }
-    *dst = nullptr;
-    return 0;
+void cfg::LiveConfig::Drop(unsigned int reader) {
+    if (state && reader < CFG_LIVE_READERS_MAX)
+        state->slots[reader].hazard.store(nullptr, std::memory_order_release);
 }
 
-void cfg::Container::Release() {
-    ReleaseHeap(&base_heap);
-    cbk::free(base_heap.base);
-    heap = nullptr;
-    first = nullptr;
-    file_type = eFileType_Unknown;
+void cfg::LiveConfig::Reclaim() {
+    if (!state)
+        return;
+#if !defined(CFGPARSE_NO_THREADS)
+    std::lock_guard<std::mutex> lock(state->writer);
+#endif
+    ReclaimRetired(state);
 }
 
-cfg::Node *cfg::Container::GetNode(char *name, unsigned int depth) {
-    auto n = first;
-    while (n) {
-        if (cfg::StringCompare(name, n->name))
-            return n;
-        if (depth) {
-            auto r = n->GetChild(name, depth);
-            if (r)
-                return r;
-        }
-        n = n->next;
+void cfg::LiveConfig::Release() {
+    if (!state)
+        return;
+#if !defined(CFGPARSE_NO_THREADS)
+    // Requests that haven't started are dropped, one being parsed is finished first.
+    {
+        std::lock_guard<std::mutex> lock(state->queue);
+        cbk::free(state->pending.path);
+        state->pending.path = nullptr;
     }
-    return nullptr;
+    if (state->worker.joinable())
+        state->worker.join();
+#endif
+
+    if (auto ctn = state->current.load())
+        ReleaseLiveContainer(ctn);
+    while (auto r = state->retired) {
+        state->retired = r->next;
+        ReleaseLiveContainer(r->ctn);
+        cbk::free(r);
+    }
+
+    auto allocation = state->allocation;
+    state->~LiveState();
+    cbk::free(allocation);
+    state = nullptr;
 }
 
 #endif // CFGPARSE_IMPLEMENTATION